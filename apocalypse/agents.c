@@ -0,0 +1,440 @@
+#include <string.h>
+#include <limits.h>
+
+#include "agents.h"
+#include "simulation.h"
+#include "bearing.h"
+#include "random.h"
+#include "constants.h"
+#include "log.h"
+
+#define INITIAL_AGENT_CAPACITY 1024
+
+/**
+ * The hash keeps the indices of the agents as int.
+ */
+#define MAX_AGENTS INT_MAX
+
+/**
+ * Multiplicative hashing (Knuth); the top bits are the slot.
+ */
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+static inline size_t hashSlot(AgentWorldPtr world, int x, int y) {
+	unsigned long long key = (unsigned long long) x * world->height + y;
+	return (key * HASH_MULTIPLIER) >> world->hashShift;
+}
+
+/**
+ * Wraps the coordinate around the edge of the world.
+ * The coordinate may be any distance outside.
+ */
+static inline int wrap(int coordinate, int size) {
+	coordinate %= size;
+	return coordinate < 0 ? coordinate + size : coordinate;
+}
+
+/**
+ * Allocates the memory or exits if it cannot.
+ */
+static void * reallocAgents(void * memory, size_t bytes) {
+	memory = realloc(memory, bytes);
+	if (memory == NULL) {
+		LOG_ERROR("Could not allocate %zu bytes of agents\n", bytes);
+		exit(1);
+	}
+	return memory;
+}
+
+static void insertIntoHash(AgentWorldPtr world, int agent) {
+	size_t mask = world->hashSize - 1;
+	size_t slot = hashSlot(world, world->agents[agent].x,
+			world->agents[agent].y);
+	while (world->hash[slot] != -1) {
+		slot = (slot + 1) & mask;
+	}
+	world->hash[slot] = agent;
+}
+
+/**
+ * Allocates the hash with the given number of slots (a power of two)
+ * and inserts all the agents into it.
+ */
+static void rebuildHash(AgentWorldPtr world, size_t hashSize) {
+	free(world->hash);
+	world->hashSize = hashSize;
+	world->hashShift = 64 - __builtin_ctzll(hashSize);
+	world->hash = (int *) reallocAgents(NULL, sizeof(int) * hashSize);
+	memset(world->hash, -1, sizeof(int) * hashSize);
+	for (int i = 0; i < world->agentCount; i++) {
+		insertIntoHash(world, i);
+	}
+}
+
+AgentWorldPtr newAgentWorld(unsigned int width, unsigned int height) {
+	AgentWorldPtr world = (AgentWorldPtr) reallocAgents(NULL,
+			sizeof(AgentWorld));
+
+	world->clock = 0;
+	world->stats = NO_STATS;
+	world->stats.clock = world->clock;
+	world->stats.width = width;
+	world->stats.height = height;
+
+	world->width = width;
+	world->height = height;
+
+	world->agentCount = 0;
+	world->agentCapacity = INITIAL_AGENT_CAPACITY;
+	world->agents = (Agent *) reallocAgents(NULL,
+			sizeof(Agent) * world->agentCapacity);
+	world->order = (int *) reallocAgents(NULL,
+			sizeof(int) * world->agentCapacity);
+
+	world->hash = NULL;
+	rebuildHash(world, 2 * INITIAL_AGENT_CAPACITY);
+
+	return world;
+}
+
+void resetAgentWorld(AgentWorldPtr world) {
+	world->agentCount = 0;
+	memset(world->hash, -1, sizeof(int) * world->hashSize);
+
+	world->stats = NO_STATS;
+	world->stats.width = world->width;
+	world->stats.height = world->height;
+}
+
+void destroyAgentWorld(AgentWorldPtr world) {
+	free(world->agents);
+	free(world->order);
+	free(world->hash);
+	free(world);
+}
+
+void addAgent(AgentWorldPtr world, int x, int y, EntityPtr entity) {
+	if (world->agentCount == world->agentCapacity) {
+		if (world->agentCapacity == MAX_AGENTS) {
+			LOG_ERROR("There can be at most %d agents\n", MAX_AGENTS);
+			exit(1);
+		}
+		world->agentCapacity = world->agentCapacity > MAX_AGENTS / 2 ?
+				MAX_AGENTS : world->agentCapacity * 2;
+		world->agents = (Agent *) reallocAgents(world->agents,
+				sizeof(Agent) * world->agentCapacity);
+		world->order = (int *) reallocAgents(world->order,
+				sizeof(int) * world->agentCapacity);
+	}
+	int agent = world->agentCount++;
+	world->agents[agent].entity = *entity;
+	world->agents[agent].x = x;
+	world->agents[agent].y = y;
+
+	// the hash is kept at most half full
+	if ((size_t) world->agentCount * 2 > world->hashSize) {
+		rebuildHash(world, world->hashSize * 2);
+	} else {
+		insertIntoHash(world, agent);
+	}
+}
+
+AgentPtr findAgent(AgentWorldPtr world, int x, int y) {
+	size_t mask = world->hashSize - 1;
+	size_t slot = hashSlot(world, x, y);
+	int agent;
+	while ((agent = world->hash[slot]) != -1) {
+		if (world->agents[agent].x == x && world->agents[agent].y == y) {
+			return world->agents + agent;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return NULL;
+}
+
+/**
+ * Returns the living or dead agent in the direction.
+ */
+static inline AgentPtr findAgentInDirection(AgentWorldPtr world, int x, int y,
+		Direction dir) {
+	return findAgent(world, wrap(x + direction_delta_x[dir], world->width),
+			wrap(y + direction_delta_y[dir], world->height));
+}
+
+/**
+ * Returns true if there is an entity in the direction.
+ * Agents which died in this step do not count.
+ */
+static inline bool isOccupied(AgentWorldPtr world, int x, int y,
+		Direction dir) {
+	AgentPtr agent = findAgentInDirection(world, x, y, dir);
+	return agent != NULL && agent->entity.type != NONE;
+}
+
+/**
+ * Returns the masks of DIRECTION_BITs of the neighbourhood
+ * in the same way as getNeighbourhoodBits.
+ */
+static void getAgentNeighbourhood(AgentWorldPtr world, int x, int y,
+		unsigned int * occupied, unsigned int * zombies,
+		unsigned int * females) {
+	*occupied = *zombies = *females = 0;
+	for (int dir = DIRECTION_START; dir <= DIRECTION_ALL; dir++) {
+		AgentPtr agent = findAgentInDirection(world, x, y, dir);
+		if (agent == NULL || agent->entity.type == NONE) {
+			continue;
+		}
+		*occupied |= DIRECTION_BIT(dir);
+		if (agent->entity.type == ZOMBIE) {
+			*zombies |= DIRECTION_BIT(dir);
+		}
+		if (agent->entity.gender == FEMALE) {
+			*females |= DIRECTION_BIT(dir);
+		}
+	}
+}
+
+/**
+ * Returns the first adjacent direction which is free in both worlds
+ * or STAY if none is free. See getFreeAdjacent.
+ */
+static Direction getFreeAdjacentAgent(AgentWorldPtr input,
+		AgentWorldPtr output, int x, int y) {
+	int permutation = randomInt(0, RANDOM_BASIC_DIRECTIONS - 1);
+	for (int i = 0; i < 4; i++) {
+		Direction dir = random_basic_directions[permutation][i];
+		if (!isOccupied(input, x, y, dir) && !isOccupied(output, x, y, dir)) {
+			return dir;
+		}
+	}
+	return STAY;
+}
+
+/**
+ * Returns a fertile MALE Living agent adjacent to the position or NULL.
+ * See findAdjacentFertileMale.
+ */
+static AgentPtr findAdjacentFertileMaleAgent(AgentWorldPtr world, int x,
+		int y, simClock clock) {
+	int permutation = randomInt(0, RANDOM_BASIC_DIRECTIONS - 1);
+	for (int i = 0; i < 4; i++) {
+		Direction dir = random_basic_directions[permutation][i];
+		AgentPtr male = findAgentInDirection(world, x, y, dir);
+		if (male == NULL || male->entity.gender != MALE
+				|| (male->entity.type != HUMAN
+						&& male->entity.type != INFECTED)) {
+			continue;
+		}
+		if (clock >= male->entity.origin + male->entity.fertilityStart
+				&& clock < male->entity.origin + male->entity.fertilityEnd) {
+			return male;
+		}
+	}
+	return NULL;
+}
+
+static int countNeighbouringZombieAgents(AgentWorldPtr world, int x, int y) {
+	int count = 0;
+	for (int dir = DIRECTION_START; dir <= DIRECTION_BASIC; dir++) {
+		AgentPtr agent = findAgentInDirection(world, x, y, dir);
+		if (agent != NULL && agent->entity.type == ZOMBIE) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * Returns true and the position if the entity can move in the direction.
+ */
+static bool canMoveTo(AgentWorldPtr input, AgentWorldPtr output, int x, int y,
+		Direction dir, int * destX, int * destY) {
+	if (isOccupied(input, x, y, dir) || isOccupied(output, x, y, dir)) {
+		return false;
+	}
+	*destX = wrap(x + direction_delta_x[dir], input->width);
+	*destY = wrap(y + direction_delta_y[dir], input->height);
+	return true;
+}
+
+void randomAgentDistribution(AgentWorldPtr world, long long people,
+		int zombies, simClock clock) {
+	world->stats.clock = clock;
+	world->stats.infectedFemales = 0;
+	world->stats.infectedMales = 0;
+
+	// the zombies are at the same cells as in randomDistribution
+	setRandomStream(clock, 0, 0, RANDOM_STREAM_WORLD);
+	Entity placeholder;
+	memset(&placeholder, 0, sizeof(Entity));
+	placeholder.type = NONE;
+	for (int i = 0; i < zombies;) {
+		int x = randomInt(0, world->width - 1);
+		int y = randomInt(0, world->height - 1);
+		if (findAgent(world, x, y) != NULL) {
+			continue;
+		}
+
+		addAgent(world, x, y, &placeholder);
+
+		i++;
+	}
+
+	// the world is sparse, so the cells are drawn by the current stream
+	// instead of deciding each of them, and the people are created
+	// afterwards by the streams of their cells as in randomDistribution
+	int first = world->agentCount;
+	for (long long i = 0; i < people;) {
+		int x = randomInt(0, world->width - 1);
+		int y = randomInt(0, world->height - 1);
+		if (findAgent(world, x, y) != NULL) {
+			continue;
+		}
+
+		addAgent(world, x, y, &placeholder);
+
+		i++;
+	}
+
+	for (int i = 0; i < world->agentCount; i++) {
+		AgentPtr agent = world->agents + i;
+		setRandomStream(clock, agent->x, agent->y, RANDOM_STREAM_INITIAL);
+		if (i < first) {
+			newZombie(&agent->entity, clock);
+			world->stats.zombies++;
+		} else {
+			newHuman(&agent->entity, clock);
+			if (agent->entity.gender == FEMALE) {
+				world->stats.humanFemales++;
+			} else {
+				world->stats.humanMales++;
+			}
+		}
+	}
+}
+
+/**
+ * The same as simulateCell2 in simulation.c.
+ */
+static void simulateAgent2(AgentWorldPtr input, AgentWorldPtr output,
+		AgentPtr agent, simClock clock, Stats * stats) {
+	Entity entity = agent->entity;
+	int x = agent->x;
+	int y = agent->y;
+
+	// Convert Human to Infected
+	if (entity.type == HUMAN) {
+		infectEntity(&entity, countNeighbouringZombieAgents(input, x, y), clock,
+				stats);
+	}
+
+	// Here are performed natural processed of humans and infected
+	if (entity.type == HUMAN || entity.type == INFECTED) {
+		// giving birth
+		if (entity.gender == FEMALE && entity.children > 0) {
+			if (entity.origin + entity.borns <= clock) {
+				if (entity.type == HUMAN) {
+					stats->humanFemalesGivingBirth++;
+				} else {
+					stats->infectedFemalesGivingBirth++;
+				}
+
+				Direction freeDir;
+				while (entity.children > 0 && (freeDir =
+						getFreeAdjacentAgent(input, output, x, y)) != STAY) {
+					Entity child = giveBirth(&entity, clock);
+					countChild(&child, stats);
+					addAgent(output, wrap(x + direction_delta_x[freeDir],
+							input->width), wrap(y + direction_delta_y[freeDir],
+							input->height), &child);
+				}
+			} else {
+				if (entity.type == HUMAN) {
+					stats->humanFemalesPregnant++;
+				} else {
+					stats->infectedFemalesPregnant++;
+				}
+			}
+		}
+
+		// making love
+		if (entity.gender == FEMALE && entity.children == 0
+				&& clock >= entity.origin + entity.fertilityStart
+				&& clock < entity.origin + entity.fertilityEnd) { // can have baby
+			AgentPtr male = findAdjacentFertileMaleAgent(input, x, y, clock);
+			if (male != NULL) {
+				Entity father = male->entity;
+				stats->couplesMakingLove++;
+				makeLove(&entity, &father, clock, input->fertilization);
+
+				stats->childrenConceived += entity.children;
+				LOG_EVENT("A couple made love\n");
+			}
+		}
+	}
+
+	countEntity(&entity, stats);
+
+	// MOVEMENT
+
+	unsigned int occupied, zombies, females;
+	getAgentNeighbourhood(input, x, y, &occupied, &zombies, &females);
+	bearing bearing_ = getBearingFromBits(occupied, zombies, females, &entity);
+	Direction dir = chooseDirection(&entity, bearing_, clock);
+
+	// we will try to find the cell in the chosen direction
+	int destX = x;
+	int destY = y;
+	if (dir != STAY) {
+		bool found = canMoveTo(input, output, x, y, dir, &destX, &destY);
+		if (randomDouble() < MOVEMENT_TRY_ALTERNATIVE) {
+			if (!found) {
+				found = canMoveTo(input, output, x, y, DIRECTION_CCW(dir),
+						&destX, &destY);
+			}
+			if (!found) {
+				found = canMoveTo(input, output, x, y, DIRECTION_CW(dir),
+						&destX, &destY);
+			}
+		}
+	}
+
+	// actual assignment of entity to its destination
+	addAgent(output, destX, destY, &entity);
+}
+
+void simulateAgentStep(AgentWorldPtr input, AgentWorldPtr output) {
+	resetAgentWorld(output);
+	output->clock = input->clock + 1;
+	simClock clock = output->clock;
+	input->fertilization = getFertilizationProbability(&input->stats);
+
+	// each agent draws from the streams of its cell as in simulateStep,
+	// so the results do not depend on the order of the agents
+	Stats stats = NO_STATS;
+	for (int i = 0; i < input->agentCount; i++) {
+		AgentPtr agent = input->agents + i;
+		setRandomStream(clock, agent->x, agent->y, RANDOM_STREAM_STEP1);
+		simulateEntity1(&agent->entity, clock, &stats);
+	}
+
+	// the agents which move first win the free cells, so they are
+	// shuffled in every step (Fisher-Yates), the same as the grid engine
+	// changes the order of its phases and directions
+	setRandomStream(clock, 0, 0, RANDOM_STREAM_WORLD);
+	int * order = input->order;
+	for (int i = 0; i < input->agentCount; i++) {
+		int j = randomInt(0, i);
+		order[i] = order[j];
+		order[j] = i;
+	}
+	for (int i = 0; i < input->agentCount; i++) {
+		AgentPtr agent = input->agents + order[i];
+		if (agent->entity.type != NONE) {
+			setRandomStream(clock, agent->x, agent->y, RANDOM_STREAM_STEP2);
+			simulateAgent2(input, output, agent, clock, &stats);
+		}
+	}
+
+	mergeStats(&output->stats, stats, true);
+}
@@ -0,0 +1,105 @@
+/*
+ * agents.h
+ *
+ * An alternative engine which stores only the entities.
+ * It is meant for worlds which are much sparser than INITIAL_DENSITY,
+ * where two maps of all the cells would not fit into memory.
+ * The density is the optional last argument of the program.
+ * The world may have more than 2^31 cells, but at most 2^31 - 1 agents.
+ */
+
+#ifndef AGENTS_H_
+#define AGENTS_H_
+
+#include "world.h"
+#include "entity.h"
+#include "stats.h"
+#include "clock.h"
+
+#ifdef USE_MPI
+#error "The agent engine runs in a single process, do not use it with USE_MPI"
+#endif
+
+/**
+ * An entity with its position.
+ */
+typedef struct Agent {
+	Entity entity;
+	int x;
+	int y;
+} Agent;
+
+typedef Agent * AgentPtr;
+
+/**
+ * The AgentWorld keeps the entities in a contiguous array.
+ * The cells are found by a spatial hash with open addressing,
+ * which maps a position to the index of the agent in the array.
+ * The world is periodic: positions are wrapped around the edges.
+ *
+ * Agents are only added; an agent which died keeps its slot
+ * with type NONE until the world is reset.
+ */
+typedef struct AgentWorld {
+	simClock clock;
+
+	Agent * agents;
+	int agentCount;
+	int agentCapacity;
+	int * order; // indices of the agents in the order of the step
+
+	int * hash; // indices of agents, -1 if the slot is empty
+	unsigned int hashShift; // 64 - log2 of the number of slots
+	size_t hashSize;
+
+	Stats stats;
+	double fertilization; // getFertilizationProbability of the stats
+
+	unsigned int width;
+	unsigned int height;
+} AgentWorld;
+
+typedef AgentWorld * AgentWorldPtr;
+
+/**
+ * Creates a new empty world of specified dimensions.
+ */
+AgentWorldPtr newAgentWorld(unsigned int width, unsigned int height);
+
+/**
+ * Removes all the agents. Takes time proportional to the size of the hash,
+ * which is at most four times the largest number of agents so far.
+ */
+void resetAgentWorld(AgentWorldPtr world);
+
+/**
+ * Destroys the agents and the world.
+ */
+void destroyAgentWorld(AgentWorldPtr world);
+
+/**
+ * Places the entity at the position which must be inside the world
+ * and must be free.
+ */
+void addAgent(AgentWorldPtr world, int x, int y, EntityPtr entity);
+
+/**
+ * Returns the agent at the position or NULL.
+ * The agent may be dead (type NONE).
+ */
+AgentPtr findAgent(AgentWorldPtr world, int x, int y);
+
+/**
+ * Fills the world with specified number of people and zombies.
+ * See randomDistribution.
+ */
+void randomAgentDistribution(AgentWorldPtr world, long long people,
+		int zombies, simClock clock);
+
+/**
+ * Runs one step of the simulation with the same rules as simulateStep.
+ * The output world is reset first; input is changed only by the deaths.
+ */
+void simulateAgentStep(AgentWorldPtr input, AgentWorldPtr output);
+
+#endif /* AGENTS_H_ */
@@ -11,56 +11,190 @@
 #include "communication.h"
 #include "output.h"
 #include "stats.h"
+#include "bearing.h"
+#include "common.h"
+#ifdef AGENT_ENGINE
+#include "agents.h"
+#endif
+
+/**
+ * Fills the cells of the tile with people, each of them with the same
+ * probability. The cells are chosen by the words of a stream of each
+ * global column, so the people do not depend on the threads
+ * or the parts of the world; each person has its own stream.
+ * Adds the females and males which were placed to the counters.
+ */
+static void populateTile(WorldPtr world, Tile tile, unsigned int threshold,
+		simClock clock, long long * females, long long * males) {
+	unsigned int words[TILE_HEIGHT];
+	int height = tile.y2 - tile.y1 + 1;
+	int globalY = world->globalYOffset + tile.y1 - world->yStart;
+	for (int x = tile.x1; x <= tile.x2; x++) {
+		int globalX = world->globalXOffset + x - world->xStart;
+		setRandomStream(clock, globalX, 0, RANDOM_STREAM_PLACEMENT);
+		skipRandomWords(globalY);
+		randomWords(words, height);
+		for (int i = 0; i < height; i++) {
+			CellIndex index = CELL_INDEX(world, x, tile.y1 + i);
+			if (words[i] >= threshold || GET_TYPE(world, index) != NONE) {
+				continue;
+			}
+			setRandomStream(clock, globalX, globalY + i,
+					RANDOM_STREAM_INITIAL);
+			Entity human;
+			newHuman(&human, clock);
+			writeCell(world, index, &human);
+			if (human.gender == FEMALE) {
+				(*females)++;
+			} else {
+				(*males)++;
+			}
+		}
+	}
+}
 
 /**
  * Fills the world with specified number of people and zombies.
  * The people are of different age; zombies are "brand new".
+ * The zombies are placed first, one by one into free cells of the whole
+ * world by the world stream of the clock. All the processes draw the same
+ * cells and each of them keeps those in its part. The people are placed
+ * in parallel by the same threads which process the tiles later,
+ * into each free cell with the probability which gives their number
+ * in the whole world on average.
  */
-void randomDistribution(WorldPtr world, int people, int zombies, simClock clock) {
+void randomDistribution(WorldPtr world, long long people, int zombies,
+		simClock clock) {
 	world->stats.clock = clock;
 	world->stats.infectedFemales = 0;
 	world->stats.infectedMales = 0;
 
-	for (int i = 0; i < people;) {
-		int x = randomInt(world->xStart, world->xEnd);
-		int y = randomInt(world->yStart, world->yEnd);
-		CellPtr cellPtr = GET_CELL_PTR(world, x, y);
-		if (cellPtr->type != NONE) {
-			continue;
+	// the cells are global, so the zombies do not depend on the parts;
+	// the processes do not see the zombies of the others,
+	// so they all keep the cells to find the taken ones
+	setRandomStream(clock, 0, 0, RANDOM_STREAM_WORLD);
+	int * cells = (int *) malloc(sizeof(int) * 2 * zombies);
+	for (int i = 0; i < zombies;) {
+		int globalX = randomInt(0, world->globalWidth - 1);
+		int globalY = randomInt(0, world->globalHeight - 1);
+		bool taken = false;
+		for (int j = 0; j < i && !taken; j++) {
+			taken = cells[2 * j] == globalX && cells[2 * j + 1] == globalY;
 		}
-
-		newHuman(cellPtr, clock);
-		if (cellPtr->gender == FEMALE) {
-			world->stats.humanFemales++;
-		} else {
-			world->stats.humanMales++;
+		if (!taken) {
+			cells[2 * i] = globalX;
+			cells[2 * i + 1] = globalY;
+			i++;
 		}
+	}
 
-		i++;
+	// each zombie has its own stream, so the world stream is the same
+	// in all the processes
+	for (int i = 0; i < zombies; i++) {
+		int x = cells[2 * i] - world->globalXOffset + world->xStart;
+		int y = cells[2 * i + 1] - world->globalYOffset + world->yStart;
+		if (x < (int) world->xStart || x > (int) world->xEnd
+				|| y < (int) world->yStart || y > (int) world->yEnd) {
+			continue; // in the part of another process
+		}
+		setRandomStream(clock, cells[2 * i], cells[2 * i + 1],
+				RANDOM_STREAM_INITIAL);
+		Entity zombie;
+		newZombie(&zombie, clock);
+		writeCell(world, CELL_INDEX(world, x, y), &zombie);
+		world->stats.zombies++;
 	}
+	free(cells);
 
-	for (int i = 0; i < zombies;) {
-		int x = randomInt(world->xStart, world->xEnd);
-		int y = randomInt(world->yStart, world->yEnd);
-		CellPtr cellPtr = GET_CELL_PTR(world, x, y);
-		if (cellPtr->type != NONE) {
-			continue;
+	// the probability is the same in all the parts
+	double probability = people
+			/ ((double) world->globalWidth * world->globalHeight);
+	unsigned int threshold = MIN(probability, 1.0) * 4294967295.0;
+	long long females = 0;
+	long long males = 0;
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:females, males)
+#endif
+	for (int phase = 0; phase < TILE_PHASES; phase++) {
+#ifdef _OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+		for (int t = world->phaseStarts[phase];
+				t < world->phaseStarts[phase + 1]; t++) {
+			populateTile(world, world->tiles[t], threshold, clock, &females,
+					&males);
 		}
+	}
+	world->stats.humanFemales += females;
+	world->stats.humanMales += males;
+}
 
-		newZombie(cellPtr, clock);
-		world->stats.zombies++;
+#ifdef AGENT_ENGINE
+/**
+ * The main loop of the agent engine. It is the same as the one in main.
+ */
+void runAgents(int width, int height, long long people, int zombies,
+		int iters) {
+	AgentWorldPtr input = newAgentWorld(width, height);
+	AgentWorldPtr output = newAgentWorld(width, height);
+
+	randomAgentDistribution(input, people, zombies, 0);
+
+#ifndef NIMAGES
+	printAgentWorld(input);
+#endif
+
+	Timer timer = startTimer();
+
+	Stats cumulative = NO_STATS;
+	for (int i = 0; i < iters; i++) {
+		simulateAgentStep(input, output);
+
+		output->stats.clock = cumulative.clock = output->clock;
+		Stats stats = output->stats;
+		mergeStats(&cumulative, stats, false);
+		printAgentStatistics(output, cumulative);
 
-		i++;
+		AgentWorldPtr temp = input;
+		input = output;
+		output = temp;
+		input->stats = stats;
 	}
+
+	double elapsedTime = getElapsedTime(timer);
+	LOG_TIME("Simulation took %f milliseconds with %d agents at the end\n",
+			elapsedTime, input->agentCount);
+
+	destroyAgentWorld(input);
+	destroyAgentWorld(output);
 }
+#endif
+
+#ifdef USE_MPI
+/**
+ * Adds the global stats reduced in the world to the cumulative ones
+ * and prints them.
+ */
+static void mergeGlobalStats(WorldPtr world, Stats * cumulative) {
+	cumulative->clock = world->globalStats.clock;
+	mergeStats(cumulative, world->globalStats, false);
+	printGlobalStatistics(world, *cumulative);
+}
+#endif
 
 int main(int argc, char **argv) {
 #ifdef USE_MPI
-	MPI_Init(&argc, &argv);
+	// only the master thread of the step calls MPI (see simulateStep)
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	if (provided < MPI_THREAD_FUNNELED) {
+		LOG_ERROR("MPI does not support MPI_THREAD_FUNNELED\n");
+	}
 #endif
 
-	if (argc != 5) {
-		LOG_ERROR("I want width, height, zombies, iterations.\n");
+	if (argc < 5 || argc > 7) {
+		LOG_ERROR("I want width, height, zombies, iterations "
+				"and optionally seed and density.\n");
 #ifdef USE_MPI
 		MPI_Finalize();
 #endif
@@ -70,15 +204,34 @@ int main(int argc, char **argv) {
 	int width = atoi(argv[1]);
 	int height = atoi(argv[2]);
 
-	int people = (int) (width * height * INITIAL_DENSITY);
 	int zombies = atoi(argv[3]);
 
 	int iters = atoi(argv[4]);
 
-	initRandom(0);
+	// zero means that the seed is taken from time; the same seed gives
+	// the same run for any number of threads, and for any number
+	// of processes only with EXCHANGE_EVERY of two or more, see random.h
+	unsigned int seed = argc >= 6 ? strtoul(argv[5], NULL, 10) : 0;
+
+	// the agent engine is meant for densities far below the default one,
+	// the population of such worlds does not fit into int
+	double density = argc == 7 ? atof(argv[6]) : INITIAL_DENSITY;
+	long long people = (long long) ((double) width * height * density);
+
+	initRandom(seed);
+	initBearingTables();
+#ifdef COMPACT_ENTITY
+	initPackedBearings();
+#endif
+
+#ifdef AGENT_ENGINE
+	runAgents(width, height, people, zombies, iters);
+	destroyRandom();
+	return 0;
+#endif
 
 	WorldPtr input, output;
-	double ratio = divideWorld(&width, &height, &input, &output);
+	divideWorld(&width, &height, &input, &output);
 
 	// there should not be any output prior to this point
 #ifdef REDIRECT
@@ -88,13 +241,11 @@ int main(int argc, char **argv) {
 	LOG_DEBUG("World size is %d x %d at position [%d, %d] of %d x %d\n",
 			input->localWidth, input->localHeight, input->globalX,
 			input->globalY, input->globalColumns, input->globalRows);
+	LOG_DEBUG("Random seed is %u\n", getRandomSeed());
+	logWorldMemory(input);
 
-	if (input->globalX == 0 && input->globalY == 0) {
-		randomDistribution(input, people * ratio, zombies, 0);
-	} else {
-		// no zombies elsewhere
-		randomDistribution(input, people * ratio, 0, 0);
-	}
+	// each process places its own people and zombies
+	randomDistribution(input, people, zombies, 0);
 
 #ifndef NIMAGES
 	printWorld(input, false);
@@ -106,17 +257,39 @@ int main(int argc, char **argv) {
 	for (int i = 0; i < iters; i++) {
 		simulateStep(input, output);
 
-		output->stats.clock = cumulative.clock = output->clock;
+		output->stats.clock = output->clock;
 		Stats stats = output->stats;
+#ifdef USE_MPI
+		// the global stats of the previous step came with the border
+		if (i > 0) {
+			mergeGlobalStats(input, &cumulative);
+		}
+#else
+		cumulative.clock = output->clock;
 		mergeStats(&cumulative, stats, false);
+#endif
 		printStatistics(output, cumulative);
 
 		WorldPtr temp = input;
 		input = output;
 		output = temp;
 		input->stats = stats;
+
+#if defined(USE_MPI) && defined(REBALANCE_EVERY)
+		if ((i + 1) % REBALANCE_EVERY == 0 && i + 1 < iters) {
+			rebalanceWorld(&input, &output);
+		}
+#endif
 	}
 
+#ifdef USE_MPI
+	if (iters > 0) {
+		// the global stats of the last step
+		reduceStatsFinish(input);
+		mergeGlobalStats(input, &cumulative);
+	}
+#endif
+
 	double elapsedTime = getElapsedTime(timer);
 
 #ifdef _OPENMP
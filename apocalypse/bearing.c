@@ -0,0 +1,161 @@
+#include "bearing.h"
+#include "constants.h"
+
+/**
+ * Class of a neighbouring cell from the point of view of the entity.
+ * Zombies do not distinguish the sex of the living.
+ */
+typedef enum NeighbourClass {
+	EMPTY_NEIGHBOUR, SAME_SEX_NEIGHBOUR, OPPOSITE_SEX_NEIGHBOUR, ZOMBIE_NEIGHBOUR
+} NeighbourClass;
+
+#define NEIGHBOUR_CLASSES 4
+
+/**
+ * The twelve neighbours are split into three groups of four directions:
+ * LEFT - DOWN, LL - UR and RR - DL.
+ * The classes of a group are encoded in 2 bits each, which gives the index.
+ */
+#define BEARING_GROUPS 3
+#define BEARING_GROUP_SIZE 4
+#define BEARING_GROUP_INDICES (1 << (2 * BEARING_GROUP_SIZE))
+
+/**
+ * Rates indexed by [entity is zombie][distance is two][class of neighbour].
+ */
+static const double bearingRates[2][2][NEIGHBOUR_CLASSES] = {
+	{
+		{ BEARING_RATE_LIVING_EMPTY_ONE, BEARING_RATE_LIVING_SAME_SEX_ONE,
+			BEARING_RATE_LIVING_OPPOSITE_SEX_ONE, BEARING_RATE_LIVING_ZOMBIE_ONE },
+		{ BEARING_RATE_LIVING_EMPTY_TWO, BEARING_RATE_LIVING_SAME_SEX_TWO,
+			BEARING_RATE_LIVING_OPPOSITE_SEX_TWO, BEARING_RATE_LIVING_ZOMBIE_TWO }
+	}, {
+		{ BEARING_RATE_ZOMBIE_EMPTY_ONE, BEARING_RATE_ZOMBIE_LIVING_ONE,
+			BEARING_RATE_ZOMBIE_LIVING_ONE, BEARING_RATE_ZOMBIE_ZOMBIE_ONE },
+		{ BEARING_RATE_ZOMBIE_EMPTY_TWO, BEARING_RATE_ZOMBIE_LIVING_TWO,
+			BEARING_RATE_ZOMBIE_LIVING_TWO, BEARING_RATE_ZOMBIE_ZOMBIE_TWO }
+	}
+};
+
+/**
+ * Sum of bearings of a group indexed by [entity is zombie][group][index].
+ */
+static bearing bearingTables[2][BEARING_GROUPS][BEARING_GROUP_INDICES];
+
+/**
+ * Spreads 4 bits into even bits: abcd -> 0a0b0c0d.
+ */
+static const unsigned char spreadBits[16] = { 0x00, 0x01, 0x04, 0x05, 0x10,
+		0x11, 0x14, 0x15, 0x40, 0x41, 0x44, 0x45, 0x50, 0x51, 0x54, 0x55 };
+
+void initBearingTables() {
+	for (int zombie = 0; zombie < 2; zombie++) {
+		for (int group = 0; group < BEARING_GROUPS; group++) {
+			for (int index = 0; index < BEARING_GROUP_INDICES; index++) {
+				double complex sum = 0;
+				for (int i = 0; i < BEARING_GROUP_SIZE; i++) {
+					int dir = DIRECTION_START + group * BEARING_GROUP_SIZE + i;
+					NeighbourClass class = (index >> (2 * i))
+							& (NEIGHBOUR_CLASSES - 1);
+					bearing delta = BEARING_FROM_DIRECTION(dir);
+					if (dir > DIRECTION_BASIC) {
+						delta /= cabsf(delta);
+					}
+					sum += delta
+							* bearingRates[zombie][dir > DIRECTION_BASIC][class];
+				}
+				bearingTables[zombie][group][index] = sum;
+			}
+		}
+	}
+}
+
+bearing getBearing(WorldPtr world, CellIndex index, EntityPtr entity) {
+	unsigned int occupied = getNeighbourhoodBits(world, world->occupiedBits,
+			index);
+	unsigned int zombies = getNeighbourhoodBits(world, world->zombieBits,
+			index);
+	unsigned int females = getNeighbourhoodBits(world, world->femaleBits,
+			index);
+	return getBearingFromBits(occupied, zombies, females, entity);
+}
+
+bearing getBearingFromBits(unsigned int occupied, unsigned int zombies,
+		unsigned int females, EntityPtr entity) {
+	unsigned int living = occupied & ~zombies;
+	unsigned int opposite = (entity->gender == FEMALE ? ~females : females)
+			& living;
+	// low and high bit of NeighbourClass of each neighbour
+	unsigned int low = (living & ~opposite) | zombies;
+	unsigned int high = opposite | zombies;
+
+	const bearing (*tables)[BEARING_GROUP_INDICES] =
+			bearingTables[entity->type == ZOMBIE];
+	bearing bearing_ = entity->bearing;
+	for (int group = 0; group < BEARING_GROUPS; group++) {
+		int shift = group * BEARING_GROUP_SIZE;
+		int groupIndex = spreadBits[(low >> shift) & 0xF]
+				| spreadBits[(high >> shift) & 0xF] << 1;
+		bearing_ += tables[group][groupIndex];
+	}
+	return bearing_;
+}
+
+bearing getBearingDirect(WorldPtr world, CellIndex index, EntityPtr entity) {
+	bearing bearing_ = entity->bearing;
+
+	for (int dir = DIRECTION_START; dir <= DIRECTION_BASIC; dir++) {
+		// all destinations are in the world
+		CellIndex cell = CELL_INDEX_DIR(world, dir, index);
+		EntityType type = GET_TYPE(world, cell);
+		bearing delta = BEARING_FROM_DIRECTION(dir);
+
+		if (entity->type == ZOMBIE) {
+			if (type == NONE) {
+				bearing_ += delta * BEARING_RATE_ZOMBIE_EMPTY_ONE;
+			} else if (type == ZOMBIE) {
+				bearing_ += delta * BEARING_RATE_ZOMBIE_ZOMBIE_ONE;
+			} else {
+				bearing_ += delta * BEARING_RATE_ZOMBIE_LIVING_ONE;
+			}
+		} else {
+			if (type == NONE) {
+				bearing_ += delta * BEARING_RATE_LIVING_EMPTY_ONE;
+			} else if (type == ZOMBIE) {
+				bearing_ += delta * BEARING_RATE_LIVING_ZOMBIE_ONE;
+			} else if (GET_GENDER(world, cell) != entity->gender) {
+				bearing_ += delta * BEARING_RATE_LIVING_OPPOSITE_SEX_ONE;
+			} else {
+				bearing_ += delta * BEARING_RATE_LIVING_SAME_SEX_ONE;
+			}
+		}
+	}
+	for (int dir = DIRECTION_BASIC + 1; dir <= DIRECTION_ALL; dir++) {
+		CellIndex cell = CELL_INDEX_DIR(world, dir, index);
+		EntityType type = GET_TYPE(world, cell);
+		bearing delta = BEARING_FROM_DIRECTION(dir);
+		delta /= cabsf(delta);
+
+		if (entity->type == ZOMBIE) {
+			if (type == NONE) {
+				bearing_ += delta * BEARING_RATE_ZOMBIE_EMPTY_TWO;
+			} else if (type == ZOMBIE) {
+				bearing_ += delta * BEARING_RATE_ZOMBIE_ZOMBIE_TWO;
+			} else {
+				bearing_ += delta * BEARING_RATE_ZOMBIE_LIVING_TWO;
+			}
+		} else {
+			if (type == NONE) {
+				bearing_ += delta * BEARING_RATE_LIVING_EMPTY_TWO;
+			} else if (type == ZOMBIE) {
+				bearing_ += delta * BEARING_RATE_LIVING_ZOMBIE_TWO;
+			} else if (GET_GENDER(world, cell) != entity->gender) {
+				bearing_ += delta * BEARING_RATE_LIVING_OPPOSITE_SEX_TWO;
+			} else {
+				bearing_ += delta * BEARING_RATE_LIVING_SAME_SEX_TWO;
+			}
+		}
+	}
+
+	return bearing_;
+}
@@ -0,0 +1,48 @@
+/*
+ * bearing.h
+ *
+ * Computes the optimal bearing of an entity from its neighbourhood.
+ */
+
+#ifndef BEARING_H_
+#define BEARING_H_
+
+#include "world.h"
+
+/**
+ * Builds the tables used by getBearing from the BEARING_RATE_* constants.
+ * This function must be called once when the program starts.
+ */
+void initBearingTables();
+
+/**
+ * Returns the optimal bearing for an entity based on twelve adjacent cells:
+ * __#__
+ * _###_
+ * ##@##
+ * _###_
+ * __#__
+ * The cells in distance one and two are handled separately.
+ * For each cell (and its entity) it is calculated the suitability to go that direction.
+ * This may can produce a result which points to a cell which is occupied.
+ * It is an intentional feature.
+ *
+ * The entity is the one which is at the index in the world.
+ */
+bearing getBearing(WorldPtr world, CellIndex index, EntityPtr entity);
+
+/**
+ * The same as getBearing but the neighbourhood is given by masks
+ * of DIRECTION_BITs as returned by getNeighbourhoodBits.
+ * Females are the occupied cells with a female.
+ */
+bearing getBearingFromBits(unsigned int occupied, unsigned int zombies,
+		unsigned int females, EntityPtr entity);
+
+/**
+ * The same as getBearing but it examines the neighbours one by one
+ * instead of using the tables. It is kept as a reference.
+ */
+bearing getBearingDirect(WorldPtr world, CellIndex index, EntityPtr entity);
+
+#endif /* BEARING_H_ */
@@ -1,157 +1,55 @@
+#include <string.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
 #include "communication.h"
 #include "mpistuff.h"
+#include "halo.h"
 #include "common.h"
 #include "log.h"
 
 void sendRecieveBorder(WorldPtr world) {
 #ifdef USE_MPI
-	int rank, destUp, destDown, destLeft, destRight;
-	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-	MPI_Cart_shift(world->comm, SHIFT_UP_DOWN, -1, &rank, &destUp);
-	MPI_Cart_shift(world->comm, SHIFT_UP_DOWN, +1, &rank, &destDown);
-	MPI_Cart_shift(world->comm, SHIFT_LEFT_RIGHT, -1, &rank, &destLeft);
-	MPI_Cart_shift(world->comm, SHIFT_LEFT_RIGHT, +1, &rank, &destRight);
-
-	{
-		// send top two rows
-		CellPtr topRow = GET_CELL_PTR(world, world->xStart, world->yStart);
-		MPI_Isend(topRow, 1, world->rowType, destUp, TOP_INPUT_BORDER_TAG,
-				world->comm, world->requests + (world->requestCount++));
-		CellPtr topRow1 = GET_CELL_PTR(world, world->xStart, world->yStart + 1);
-		MPI_Isend(topRow1, 1, world->rowType, destUp, TOP1_INPUT_BORDER_TAG,
-				world->comm, world->requests + (world->requestCount++));
-
-		// receive top two rows -> bottom border
-		CellPtr bottomBorder = GET_CELL_PTR(world, world->xStart,
-				world->yEnd + 1);
-		MPI_Irecv(bottomBorder, 1, world->rowType, destDown,
-				TOP_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr bottomBorder1 = GET_CELL_PTR(world, world->xStart,
-				world->yEnd + 2);
-		MPI_Irecv(bottomBorder1, 1, world->rowType, destDown,
-				TOP1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
-
-	{
-		// send bottom two rows
-		CellPtr bottomRow = GET_CELL_PTR(world, world->xStart, world->yEnd);
-		MPI_Isend(bottomRow, 1, world->rowType, destDown,
-				BOTTOM_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr bottomRow1 = GET_CELL_PTR(world, world->xStart,
-				world->yEnd - 1);
-		MPI_Isend(bottomRow1, 1, world->rowType, destDown,
-				BOTTOM1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-
-		// receive bottom two rows -> top border
-		CellPtr topBorder = GET_CELL_PTR(world, world->xStart,
-				world->yStart - 1);
-		MPI_Irecv(topBorder, 1, world->rowType, destUp,
-				BOTTOM_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr topBorder1 = GET_CELL_PTR(world, world->xStart,
-				world->yStart - 2);
-		MPI_Irecv(topBorder1, 1, world->rowType, destUp,
-				BOTTOM1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
-
-	{
-		// send left two columns
-		CellPtr leftColumn = GET_CELL_PTR(world, world->xStart, world->yStart);
-		MPI_Isend(leftColumn, 1, world->columnType, destLeft,
-				LEFT_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr leftRow1 = GET_CELL_PTR(world, world->xStart + 1,
-				world->yStart);
-		MPI_Isend(leftRow1, 1, world->columnType, destLeft,
-				LEFT1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-
-		// receive left two columns -> right border
-		CellPtr rightBorder = GET_CELL_PTR(world, world->xEnd + 1,
-				world->yStart);
-		MPI_Irecv(rightBorder, 1, world->columnType, destRight,
-				LEFT_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr rightBorder1 = GET_CELL_PTR(world, world->xEnd + 2,
-				world->yStart);
-		MPI_Irecv(rightBorder1, 1, world->columnType, destRight,
-				LEFT1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
-
-	{
-		// send right two columns
-		CellPtr rightColumn = GET_CELL_PTR(world, world->xEnd, world->yStart);
-		MPI_Isend(rightColumn, 1, world->columnType, destRight,
-				RIGHT_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr rightColumn1 = GET_CELL_PTR(world, world->xEnd - 1,
-				world->yStart);
-		MPI_Isend(rightColumn1, 1, world->columnType, destRight,
-				RIGHT1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-
-		// receive right two columns -> left border
-		CellPtr leftBorder = GET_CELL_PTR(world, world->xStart - 1,
-				world->yStart);
-		MPI_Irecv(leftBorder, 1, world->columnType, destLeft,
-				RIGHT_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-		CellPtr leftBorder1 = GET_CELL_PTR(world, world->xStart - 2,
-				world->yStart);
-		MPI_Irecv(leftBorder1, 1, world->columnType, destLeft,
-				RIGHT1_INPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
+	startHalo(world, &world->border);
 #else
 	// just copy borders - periodic
+#define COPY_CELL(world, destX, destY, srcX, srcY) \
+		copyCell((world), CELL_INDEX((world), (destX), (destY)), (world), \
+				CELL_INDEX((world), (srcX), (srcY)))
+	// the borders are copied by pieces of one tile length
 	{
 #ifdef _OPENMP
-		int threads = omp_get_max_threads();
-		int numThreads = MIN(MAX(world->localWidth / 10, 1), threads);
-#pragma omp parallel for schedule(static) num_threads(numThreads)
+#pragma omp for schedule(static)
 #endif
-		for (int x = world->xStart; x <= world->xEnd; x++) {
-			// filling bottom border
-			Cell x1 = GET_CELL(world, x, world->yStart);
-			GET_CELL(world, x, world->yEnd + 1) = x1;
-			Cell x2 = GET_CELL(world, x, world->yStart + 1);
-			GET_CELL(world, x, world->yEnd + 2) = x2;
-
-			// filling top border
-			Cell x3 = GET_CELL(world, x, world->yEnd);
-			GET_CELL(world, x, world->yStart - 1) = x3;
-			Cell x4 = GET_CELL(world, x, world->yEnd - 1);
-			GET_CELL(world, x, world->yStart - 2) = x4;
+		for (int x1 = world->xStart; x1 <= world->xEnd; x1 += TILE_WIDTH) {
+			int x2 = MIN(x1 + TILE_WIDTH - 1, world->xEnd);
+			for (int x = x1; x <= x2; x++) {
+				// filling bottom border
+				COPY_CELL(world, x, world->yEnd + 1, x, world->yStart);
+				COPY_CELL(world, x, world->yEnd + 2, x, world->yStart + 1);
+
+				// filling top border
+				COPY_CELL(world, x, world->yStart - 1, x, world->yEnd);
+				COPY_CELL(world, x, world->yStart - 2, x, world->yEnd - 1);
+			}
 		}
 	}
 	{
 #ifdef _OPENMP
-		int threads = omp_get_max_threads();
-		int numThreads = MIN(MAX(world->localHeight / 10, 1), threads);
-#pragma omp parallel for schedule(static) num_threads(numThreads)
+#pragma omp for schedule(static)
 #endif
-		for (int y = world->yStart; y <= world->yEnd; y++) {
-			// filling right border
-			Cell y1 = GET_CELL(world, world->xStart, y);
-			GET_CELL(world, world->xEnd + 1, y) = y1;
-			Cell y2 = GET_CELL(world, world->xStart + 1, y);
-			GET_CELL(world, world->xEnd + 2, y) = y2;
-
-			// filling left border
-			Cell y3 = GET_CELL(world, world->xEnd, y);
-			GET_CELL(world, world->xStart - 1, y) = y3;
-			Cell y4 = GET_CELL(world, world->xEnd - 1, y);
-			GET_CELL(world, world->xStart - 2, y) = y4;
+		for (int y1 = world->yStart; y1 <= world->yEnd; y1 += TILE_HEIGHT) {
+			int y2 = MIN(y1 + TILE_HEIGHT - 1, world->yEnd);
+			for (int y = y1; y <= y2; y++) {
+				// filling right border
+				COPY_CELL(world, world->xEnd + 1, y, world->xStart, y);
+				COPY_CELL(world, world->xEnd + 2, y, world->xStart + 1, y);
+
+				// filling left border
+				COPY_CELL(world, world->xStart - 1, y, world->xEnd, y);
+				COPY_CELL(world, world->xStart - 2, y, world->xEnd - 1, y);
+			}
 		}
 	}
 #endif
@@ -160,86 +58,35 @@ void sendRecieveBorder(WorldPtr world) {
 void sendRecieveBorderFinish(WorldPtr world) {
 #ifdef USE_MPI
 	Timer timer = startTimer();
-	MPI_Waitall(world->requestCount, world->requests, MPI_STATUSES_IGNORE);
-	world->requestCount = 0;
+	finishHalo(world, &world->border);
+	// the stats reduction of the previous step
+	reduceStatsFinish(world);
 
-	double elapsedTime = getElapsedTime(timer);
-	LOG_DEBUG("Waited for borders for %f milliseconds\n", elapsedTime);
+#ifdef _OPENMP
+#pragma omp master
 #endif
-}
-
-void sendReceiveGhosts(WorldPtr world) {
-#ifdef USE_MPI
-	int rank, destUp, destDown, destLeft, destRight;
-	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-	MPI_Cart_shift(world->comm, SHIFT_UP_DOWN, -1, &rank, &destUp);
-	MPI_Cart_shift(world->comm, SHIFT_UP_DOWN, +1, &rank, &destDown);
-	MPI_Cart_shift(world->comm, SHIFT_LEFT_RIGHT, -1, &rank, &destLeft);
-	MPI_Cart_shift(world->comm, SHIFT_LEFT_RIGHT, +1, &rank, &destRight);
-
-	{
-		// send top inner border
-		CellPtr topInnerBorder = GET_CELL_PTR(world, world->xStart,
-				world->yStart - 1);
-		MPI_Isend(topInnerBorder, 1, world->rowType, destUp,
-				TOP_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-
-		// receive top inner border -> top outer border
-		CellPtr bottomOuterBorder = GET_CELL_PTR(world, world->xStart,
-				world->yEnd + 2);
-		MPI_Irecv(bottomOuterBorder, 1, world->rowType, destDown,
-				TOP_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
-
-	{
-		// send bottom inner border
-		CellPtr bottomInnerBorder = GET_CELL_PTR(world, world->xStart,
-				world->yEnd + 1);
-		MPI_Isend(bottomInnerBorder, 1, world->rowType, destDown,
-				BOTTOM_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-
-		// receive bottom inner border -> bottom outer border
-		CellPtr topOuterBorder = GET_CELL_PTR(world, world->xStart,
-				world->yStart - 2);
-		MPI_Irecv(topOuterBorder, 1, world->rowType, destUp,
-				BOTTOM_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
-
 	{
-		// send left inner border
-		CellPtr leftInnerBorder = GET_CELL_PTR(world, world->xStart - 1,
-				world->yStart);
-		MPI_Isend(leftInnerBorder, 1, world->columnType, destLeft,
-				LEFT_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-
-		// receive left inner border -> left outer border
-		CellPtr rightOuterBorder = GET_CELL_PTR(world, world->xEnd + 2,
-				world->yStart);
-		MPI_Irecv(rightOuterBorder, 1, world->columnType, destRight,
-				LEFT_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
+		double elapsedTime = getElapsedTime(timer);
+		LOG_DEBUG("Waited for borders for %f milliseconds\n", elapsedTime);
 	}
 
-	{
-		// send right inner border
-		CellPtr rightInnerBorder = GET_CELL_PTR(world, world->xEnd + 1,
-				world->yStart);
-		MPI_Isend(rightInnerBorder, 1, world->columnType, destRight,
-				RIGHT_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
+	// the border was written by MPI, the columns with the corners if any
+	int lines = world->border.lines;
+	int corners = world->border.sideCount > HALO_EDGES ? lines : 0;
+	refreshBits(world, world->xStart, world->xEnd, world->yStart - lines,
+			world->yStart - 1);
+	refreshBits(world, world->xStart, world->xEnd, world->yEnd + 1,
+			world->yEnd + lines);
+	refreshBits(world, world->xStart - lines, world->xStart - 1,
+			world->yStart - corners, world->yEnd + corners);
+	refreshBits(world, world->xEnd + 1, world->xEnd + lines,
+			world->yStart - corners, world->yEnd + corners);
+#endif
+}
 
-		// receive right inner border -> right outer border
-		CellPtr leftOuterBorder = GET_CELL_PTR(world, world->xStart - 2,
-				world->yStart);
-		MPI_Irecv(leftOuterBorder, 1, world->columnType, destLeft,
-				RIGHT_OUTPUT_BORDER_TAG, world->comm,
-				world->requests + (world->requestCount++));
-	}
+void sendReceiveGhosts(WorldPtr world) {
+#ifdef USE_MPI
+	startHalo(world, &world->ghosts);
 #endif
 }
 
@@ -247,30 +94,29 @@ void sendReceiveGhosts(WorldPtr world) {
  * Moves back an entity which is on the ghost cell.
  */
 static void mergeInto(WorldPtr world, int srcX, int srcY, int destX, int destY) {
-	EntityPtr from = GET_CELL_PTR(world, srcX, srcY);
-	if (from->type != NONE) {
-		if (GET_CELL(world, destX, destY).type == NONE) {
-			GET_CELL(world, destX, destY) = *from;
+	CellIndex from = CELL_INDEX(world, srcX, srcY);
+	if (GET_TYPE(world, from) != NONE) {
+		CellIndex to = CELL_INDEX(world, destX, destY);
+		if (GET_TYPE(world, to) == NONE) {
+			copyCell(world, to, world, from);
 		}
-		from->type = NONE;
+		clearCell(world, from);
 	}
 }
 
 void sendReceiveGhostsFinish(WorldPtr world) {
 #ifdef USE_MPI
 	Timer timer = startTimer();
-	if (world->requestCount % 2 == 0) {
-		MPI_Waitall(world->requestCount, world->requests, MPI_STATUSES_IGNORE);
-		world->requestCount = 0;
-	} else { // there must be one extra request, which is stats reducing
-		// will wait for all except for the last request
-		MPI_Waitall(world->requestCount-1, world->requests, MPI_STATUSES_IGNORE);
-		world->requests[0] = world->requests[world->requestCount - 1];
-		world->requestCount = 1;
-	}
+	// the stats reduction goes on until the next border
+	finishHalo(world, &world->ghosts);
 
-	double elapsedTime = getElapsedTime(timer);
-	LOG_DEBUG("Waited for ghosts for %f milliseconds\n", elapsedTime);
+#ifdef _OPENMP
+#pragma omp master
+#endif
+	{
+		double elapsedTime = getElapsedTime(timer);
+		LOG_DEBUG("Waited for ghosts for %f milliseconds\n", elapsedTime);
+	}
 #endif
 
 	// now, we will merge ghost into the last cell
@@ -279,13 +125,13 @@ void sendReceiveGhostsFinish(WorldPtr world) {
 	// we may leave border in any condition
 	// next time the world will be input world
 	// and the border will be replaced
+	// the ghosts are merged by pieces of one tile length
 	{
 #ifdef _OPENMP
-		int threads = omp_get_max_threads();
-		int numThreads = MIN(MAX(world->localWidth / 10, 1), threads);
-#pragma omp parallel for schedule(static) num_threads(numThreads)
+#pragma omp for schedule(static)
 #endif
-		for (int x = world->xStart; x <= world->xEnd; x++) {
+		for (int xTile = world->xStart; xTile <= world->xEnd;
+				xTile += TILE_WIDTH) {
 #ifdef USE_MPI
 			int y1 = world->yStart - 2;
 			int y2 = world->yEnd + 2;
@@ -293,18 +139,20 @@ void sendReceiveGhostsFinish(WorldPtr world) {
 			int y1 = world->yEnd + 1;
 			int y2 = world->yStart - 1;
 #endif
-			mergeInto(world, x, y1, x, world->yStart);
-			mergeInto(world, x, y2, x, world->yEnd);
+			int xTileEnd = MIN(xTile + TILE_WIDTH - 1, world->xEnd);
+			for (int x = xTile; x <= xTileEnd; x++) {
+				mergeInto(world, x, y1, x, world->yStart);
+				mergeInto(world, x, y2, x, world->yEnd);
+			}
 		}
 	}
 
 	{
 #ifdef _OPENMP
-		int threads = omp_get_max_threads();
-		int numThreads = MIN(MAX(world->localHeight / 10, 1), threads);
-#pragma omp parallel for schedule(static) num_threads(numThreads)
+#pragma omp for schedule(static)
 #endif
-		for (int y = world->yStart; y <= world->yEnd; y++) {
+		for (int yTile = world->yStart; yTile <= world->yEnd;
+				yTile += TILE_HEIGHT) {
 #ifdef USE_MPI
 			int x1 = world->xStart - 2;
 			int x2 = world->xEnd + 2;
@@ -312,12 +160,112 @@ void sendReceiveGhostsFinish(WorldPtr world) {
 			int x1 = world->xEnd + 1;
 			int x2 = world->xStart - 1;
 #endif
-			mergeInto(world, x1, y, world->xStart, y);
-			mergeInto(world, x2, y, world->xEnd, y);
+			int yTileEnd = MIN(yTile + TILE_HEIGHT - 1, world->yEnd);
+			for (int y = yTile; y <= yTileEnd; y++) {
+				mergeInto(world, x1, y, world->xStart, y);
+				mergeInto(world, x2, y, world->xEnd, y);
+			}
 		}
 	}
 }
 
+#ifdef USE_MPI
+/**
+ * Looks up the ranks of the eight neighbours in the cartesian communicator,
+ * which is periodic.
+ */
+static void getNeighbours(MPI_Comm comm, int neighbours[HALO_SIDES]) {
+	MPI_Cart_shift(comm, SHIFT_UP_DOWN, 1, neighbours + HALO_UP,
+			neighbours + HALO_DOWN);
+	MPI_Cart_shift(comm, SHIFT_LEFT_RIGHT, 1, neighbours + HALO_LEFT,
+			neighbours + HALO_RIGHT);
+
+	int rank;
+	int position[2];
+	MPI_Comm_rank(comm, &rank);
+	MPI_Cart_coords(comm, rank, 2, position);
+	int corners[HALO_SIDES][2] = {
+			[HALO_UP_LEFT] = { -1, -1 },
+			[HALO_UP_RIGHT] = { 1, -1 },
+			[HALO_DOWN_LEFT] = { -1, 1 },
+			[HALO_DOWN_RIGHT] = { 1, 1 } };
+	for (int side = HALO_EDGES; side < HALO_SIDES; side++) {
+		int corner[2] = { position[0] + corners[side][0], position[1]
+				+ corners[side][1] };
+		MPI_Cart_rank(comm, corner, neighbours + side);
+	}
+}
+
+/**
+ * Sets one side of the halo: the first lines which are sent
+ * and received and the ranks of the neighbours in both directions.
+ */
+static void setHaloSide(HaloSide * side, int destination, int source,
+		int sendX, int sendY, int receiveX, int receiveY, int lineStep) {
+	side->destination = destination;
+	side->source = source;
+	side->sendX = sendX;
+	side->sendY = sendY;
+	side->receiveX = receiveX;
+	side->receiveY = receiveY;
+	side->lineStep = lineStep;
+}
+
+/**
+ * Creates both halos of the world.
+ * The border halo sends BORDER_LINES inner lines and receives as many
+ * outer lines, the deep one of EXCHANGE_EVERY together with the corners.
+ * The ghosts halo sends the outer line next to the interior
+ * and receives the far outer line.
+ */
+static void initHalos(WorldPtr w, const int neighbours[HALO_SIDES]) {
+	int up = neighbours[HALO_UP];
+	int down = neighbours[HALO_DOWN];
+	int left = neighbours[HALO_LEFT];
+	int right = neighbours[HALO_RIGHT];
+
+	HaloSide * border = w->border.sides;
+	setHaloSide(border + HALO_UP, up, down, w->xStart, w->yStart, w->xStart,
+			w->yEnd + 1, 1);
+	setHaloSide(border + HALO_DOWN, down, up, w->xStart, w->yEnd, w->xStart,
+			w->yStart - 1, -1);
+	setHaloSide(border + HALO_LEFT, left, right, w->xStart, w->yStart,
+			w->xEnd + 1, w->yStart, 1);
+	setHaloSide(border + HALO_RIGHT, right, left, w->xEnd, w->yStart,
+			w->xStart - 1, w->yStart, -1);
+#ifdef EXCHANGE_EVERY
+	// the corners are squares of columns
+	int lines = BORDER_LINES;
+	setHaloSide(border + HALO_UP_LEFT, neighbours[HALO_UP_LEFT],
+			neighbours[HALO_DOWN_RIGHT], w->xStart, w->yStart, w->xEnd + 1,
+			w->yEnd + 1, 1);
+	setHaloSide(border + HALO_UP_RIGHT, neighbours[HALO_UP_RIGHT],
+			neighbours[HALO_DOWN_LEFT], w->xEnd, w->yStart, w->xStart - 1,
+			w->yEnd + 1, -1);
+	setHaloSide(border + HALO_DOWN_LEFT, neighbours[HALO_DOWN_LEFT],
+			neighbours[HALO_UP_RIGHT], w->xStart, w->yEnd - lines + 1,
+			w->xEnd + 1, w->yStart - lines, 1);
+	setHaloSide(border + HALO_DOWN_RIGHT, neighbours[HALO_DOWN_RIGHT],
+			neighbours[HALO_UP_LEFT], w->xEnd, w->yEnd - lines + 1,
+			w->xStart - 1, w->yStart - lines, -1);
+	initHalo(w, &w->border, HALO_SIDES, lines, BORDER_HALO_TAG);
+#else
+	initHalo(w, &w->border, HALO_EDGES, BORDER_LINES, BORDER_HALO_TAG);
+#endif
+
+	HaloSide * ghosts = w->ghosts.sides;
+	setHaloSide(ghosts + HALO_UP, up, down, w->xStart, w->yStart - 1,
+			w->xStart, w->yEnd + 2, 1);
+	setHaloSide(ghosts + HALO_DOWN, down, up, w->xStart, w->yEnd + 1,
+			w->xStart, w->yStart - 2, 1);
+	setHaloSide(ghosts + HALO_LEFT, left, right, w->xStart - 1, w->yStart,
+			w->xEnd + 2, w->yStart, 1);
+	setHaloSide(ghosts + HALO_RIGHT, right, left, w->xEnd + 1, w->yStart,
+			w->xStart - 2, w->yStart, 1);
+	initHalo(w, &w->ghosts, HALO_EDGES, 1, GHOSTS_HALO_TAG);
+}
+#endif
+
 __attribute__ ((unused)) // used when compiled for MPI
 static int divideArea(int width, int height, int parts) {
 	int bestScore = 1 << 30;
@@ -342,6 +290,43 @@ static int sizeOfPart(int size, int parts, int part) {
 	return (part + 1) * size / parts - part * size / parts;
 }
 
+/**
+ * Returns the position of the first cell of the part.
+ */
+static int offsetOfPart(int size, int parts, int part) {
+	return part * size / parts;
+}
+
+void reduceStats(WorldPtr world) {
+#ifdef USE_MPI
+#ifdef _OPENMP
+#pragma omp master
+#endif
+	{
+		// a copy, as the stats of the world change before the reduction ends
+		world->sentStats = world->stats;
+		world->globalStats.clock = world->clock;
+		MPI_Iallreduce(&world->sentStats.humanFemales,
+				&world->globalStats.humanFemales, STATS_COUNTERS,
+				MPI_LONG_LONG, MPI_SUM, world->comm,
+				world->requests + (world->requestCount++));
+	}
+#endif
+}
+
+void reduceStatsFinish(WorldPtr world) {
+#ifdef USE_MPI
+#ifdef _OPENMP
+#pragma omp master
+#endif
+	{
+		MPI_Waitall(world->requestCount, world->requests,
+				MPI_STATUSES_IGNORE);
+		world->requestCount = 0;
+	}
+#endif
+}
+
 double divideWorld(int * width, int * height, WorldPtr * input,
 		WorldPtr * output) {
 #ifdef USE_MPI
@@ -349,6 +334,19 @@ double divideWorld(int * width, int * height, WorldPtr * input,
 	MPI_Comm_size(MPI_COMM_WORLD, &size);
 	int globalColumns = divideArea(*width, *height, size);
 	int globalRows = size / globalColumns;
+#ifdef EXCHANGE_EVERY
+	// the colours of the cells must go on across the edges of the world
+	// and the deep border must fit into the parts of the neighbours
+	if (*width % STEP_COLOURS != 0 || *height % STEP_COLOURS != 0
+			|| *width / globalColumns < BORDER_LINES
+			|| *height / globalRows < BORDER_LINES) {
+		LOG_ERROR("With EXCHANGE_EVERY, the width and height must be "
+				"multiples of %d and the parts at least %d wide and high\n",
+				STEP_COLOURS, BORDER_LINES);
+		MPI_Finalize();
+		exit(1);
+	}
+#endif
 
 	int worldSize[2] = {globalColumns, globalRows};
 	int periods[2] = {1, 1};
@@ -363,6 +361,10 @@ double divideWorld(int * width, int * height, WorldPtr * input,
 	MPI_Cart_coords(commCart, rank, 2, position);
 	int globalX = position[0];
 	int globalY = position[1];
+
+	// the neighbours do not change, so they are looked up once
+	int neighbours[HALO_SIDES];
+	getNeighbours(commCart, neighbours);
 #else
 	int globalColumns = 1;
 	int globalRows = 1;
@@ -372,20 +374,6 @@ double divideWorld(int * width, int * height, WorldPtr * input,
 	int newWidth = sizeOfPart(*width, globalColumns, globalX);
 	int newHeight = sizeOfPart(*height, globalRows, globalY);
 
-#ifdef USE_MPI
-	MPI_Datatype cellType;
-	MPI_Type_contiguous(sizeof(Cell), MPI_BYTE, &cellType);
-	MPI_Type_commit(&cellType);
-
-	MPI_Datatype rowType;
-	MPI_Type_vector(newWidth, 1, newHeight + 4, cellType, &rowType);
-	MPI_Type_commit(&rowType);
-
-	MPI_Datatype columnType;
-	MPI_Type_vector(1, newHeight, -1, cellType, &columnType);
-	MPI_Type_commit(&columnType);
-#endif
-
 	WorldPtr worlds[2] = { newWorld(newWidth, newHeight), newWorld(newWidth,
 			newHeight) };
 
@@ -397,12 +385,18 @@ double divideWorld(int * width, int * height, WorldPtr * input,
 		w->globalRows = globalRows;
 		w->globalX = globalX;
 		w->globalY = globalY;
+		w->globalXOffset = offsetOfPart(*width, globalColumns, globalX);
+		w->globalYOffset = offsetOfPart(*height, globalRows, globalY);
 #ifdef USE_MPI
 		w->comm = commCart;
 		// w->requests is uninitialized; works as stack
 		w->requestCount = 0;
-		w->rowType = rowType;
-		w->columnType = columnType;
+		// nothing was reduced yet
+		w->globalStats = NO_STATS;
+		w->globalStats.clock = -1;
+		w->globalStats.width = *width;
+		w->globalStats.height = *height;
+		initHalos(w, neighbours);
 #endif
 	}
 
@@ -415,3 +409,371 @@ double divideWorld(int * width, int * height, WorldPtr * input,
 	*height = newHeight;
 	return ratio;
 }
+
+#ifdef USE_MPI
+/**
+ * A part of the world in global coordinates of its interior.
+ */
+typedef struct Part {
+	int globalX; // position of the process in the grid
+	int globalY;
+	int x;
+	int y;
+	int width;
+	int height;
+} Part;
+
+/**
+ * Returns the count of cells which are in both parts and sets
+ * the common rectangle to intersection.
+ */
+static int intersectParts(const Part * a, const Part * b, Part * intersection) {
+	intersection->x = MAX(a->x, b->x);
+	intersection->y = MAX(a->y, b->y);
+	intersection->width = MIN(a->x + a->width, b->x + b->width)
+			- intersection->x;
+	intersection->height = MIN(a->y + a->height, b->y + b->height)
+			- intersection->y;
+	if (intersection->width <= 0 || intersection->height <= 0) {
+		return 0;
+	}
+	return intersection->width * intersection->height;
+}
+
+/**
+ * Copies the cells of the rectangle between the world and the buffer,
+ * plane by plane and column by column. Returns the end of the data.
+ */
+static char * copyPart(WorldPtr world, const Part * part, char * buffer,
+		bool pack) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+	int x1 = part->x - world->globalXOffset + world->xStart;
+	int y1 = part->y - world->globalYOffset + world->yStart;
+	for (int p = 0; p < CELL_PLANES; p++) {
+		size_t bytes = part->height * sizes[p];
+		for (int x = x1; x < x1 + part->width; x++) {
+			char * cells = (char *) bases[p]
+					+ CELL_INDEX(world, x, y1) * sizes[p];
+			memcpy(pack ? buffer : cells, pack ? cells : buffer, bytes);
+			buffer += bytes;
+		}
+	}
+	return buffer;
+}
+
+/**
+ * Counts the entities in the interior of the world. When the loads
+ * are given, the cost of the entities is added to the global columns
+ * and rows where they are.
+ */
+static long long countEntities(WorldPtr world, long long * columnLoads,
+		long long * rowLoads) {
+	long long entities = 0;
+	for (int x = world->xStart; x <= world->xEnd; x++) {
+		CellIndex column = CELL_INDEX(world, x, 0);
+		CellIndex first = CELL_INDEX(world, x, world->yStart);
+		CellIndex last = CELL_INDEX(world, x, world->yEnd);
+		long long columnEntities = 0;
+		for (CellIndex word = BIT_WORD(first); word <= BIT_WORD(last);
+				word++) {
+			BitWord occupied = getWordBits(world->occupiedBits, word, first,
+					last);
+			columnEntities += __builtin_popcountll(occupied);
+			while (rowLoads != NULL && occupied != 0) {
+				CellIndex index = word * BITS_IN_WORD + LOWEST_BIT(occupied);
+				occupied &= occupied - 1;
+				rowLoads[world->globalYOffset + index - column
+						- world->yStart] += REBALANCE_ENTITY_COST;
+			}
+		}
+		if (columnLoads != NULL) {
+			columnLoads[world->globalXOffset + x - world->xStart] +=
+					REBALANCE_ENTITY_COST * columnEntities;
+		}
+		entities += columnEntities;
+	}
+	return entities;
+}
+
+/**
+ * Returns the ratio of the largest load of a process to the mean load.
+ * The load is the cost of the entities and the cells of the part.
+ */
+static double getImbalance(WorldPtr world, long long * entities) {
+	long long local[2];
+	local[0] = countEntities(world, NULL, NULL);
+	local[1] = REBALANCE_ENTITY_COST * local[0]
+			+ (long long) world->localWidth * world->localHeight;
+	long long sums[2];
+	long long maxLoad;
+	MPI_Allreduce(local, sums, 2, MPI_LONG_LONG, MPI_SUM, world->comm);
+	MPI_Allreduce(local + 1, &maxLoad, 1, MPI_LONG_LONG, MPI_MAX,
+			world->comm);
+	*entities = sums[0];
+	int processes = world->globalColumns * world->globalRows;
+	return maxLoad / ((double) sums[1] / processes);
+}
+
+/**
+ * Splits the loads into parts of about the same sum, each of them
+ * at least REBALANCE_MIN_SIZE long. Offsets get parts + 1 items.
+ */
+static void balanceLoads(const long long * loads, int size, int parts,
+		int * offsets) {
+	long long total = 0;
+	for (int i = 0; i < size; i++) {
+		total += loads[i];
+	}
+	offsets[0] = 0;
+	offsets[parts] = size;
+	long long sum = 0;
+	int i = 0;
+	for (int part = 1; part < parts; part++) {
+		long long target = total * part / parts;
+		// the border is placed where the sum is closest to the target
+		while (i < size && sum + loads[i] / 2 < target) {
+			sum += loads[i++];
+		}
+		int offset = MAX(i, offsets[part - 1] + REBALANCE_MIN_SIZE);
+		offset = MIN(offset, size - (parts - part) * REBALANCE_MIN_SIZE);
+		for (; i < offset; i++) {
+			sum += loads[i];
+		}
+		for (; i > offset; i--) {
+			sum -= loads[i - 1];
+		}
+		offsets[part] = offset;
+	}
+}
+
+/**
+ * Counts the entities in the rectangle, which must be in the part
+ * of the world.
+ */
+static long long countPartEntities(WorldPtr world, const Part * part) {
+	int x1 = part->x - world->globalXOffset + world->xStart;
+	int y1 = part->y - world->globalYOffset + world->yStart;
+	long long entities = 0;
+	for (int x = x1; x < x1 + part->width; x++) {
+		CellIndex first = CELL_INDEX(world, x, y1);
+		CellIndex last = CELL_INDEX(world, x, y1 + part->height - 1);
+		for (CellIndex word = BIT_WORD(first); word <= BIT_WORD(last);
+				word++) {
+			entities += __builtin_popcountll(
+					getWordBits(world->occupiedBits, word, first, last));
+		}
+	}
+	return entities;
+}
+
+/**
+ * Returns the imbalance which the new parts would have, as getImbalance
+ * would measure it after the migration.
+ */
+static double predictImbalance(WorldPtr world, const Part * oldParts,
+		const Part * newParts, int processes, int rank) {
+	long long * loads = (long long *) calloc(processes, sizeof(long long));
+	for (int r = 0; r < processes; r++) {
+		Part common;
+		if (intersectParts(oldParts + rank, newParts + r, &common) > 0) {
+			loads[r] = REBALANCE_ENTITY_COST
+					* countPartEntities(world, &common);
+		}
+	}
+	MPI_Allreduce(MPI_IN_PLACE, loads, processes, MPI_LONG_LONG, MPI_SUM,
+			world->comm);
+	long long sum = 0;
+	long long maxLoad = 0;
+	for (int r = 0; r < processes; r++) {
+		loads[r] += (long long) newParts[r].width * newParts[r].height;
+		sum += loads[r];
+		maxLoad = MAX(maxLoad, loads[r]);
+	}
+	free(loads);
+	return maxLoad / ((double) sum / processes);
+}
+
+/**
+ * Creates a world for the new part, which takes everything but the cells
+ * from the old world.
+ */
+static WorldPtr newPart(WorldPtr old, const Part * part) {
+	WorldPtr w = newWorld(part->width, part->height);
+	w->clock = old->clock;
+	w->stats = old->stats;
+	w->globalWidth = old->globalWidth;
+	w->globalHeight = old->globalHeight;
+	w->globalColumns = old->globalColumns;
+	w->globalRows = old->globalRows;
+	w->globalX = old->globalX;
+	w->globalY = old->globalY;
+	w->globalXOffset = part->x;
+	w->globalYOffset = part->y;
+	w->stats.width = part->width;
+	w->stats.height = part->height;
+	w->comm = old->comm;
+	w->requestCount = 0;
+	w->globalStats = old->globalStats;
+
+	int neighbours[HALO_SIDES];
+	getNeighbours(w->comm, neighbours);
+	initHalos(w, neighbours);
+	return w;
+}
+
+void rebalanceWorld(WorldPtr * input, WorldPtr * output) {
+	WorldPtr in = *input;
+	Timer timer = startTimer();
+	bool first = in->globalX == 0 && in->globalY == 0;
+	// the stats of the last step are still being reduced
+	reduceStatsFinish(in);
+
+	long long entities;
+	double imbalance = getImbalance(in, &entities);
+	bool tooSmall = in->globalWidth < in->globalColumns * REBALANCE_MIN_SIZE
+			|| in->globalHeight < in->globalRows * REBALANCE_MIN_SIZE;
+	if (imbalance < REBALANCE_THRESHOLD || tooSmall) {
+		if (first) {
+			LOG_DEBUG("Imbalance %f at %lld is below the threshold\n",
+					imbalance, in->clock);
+		}
+		return;
+	}
+
+	// the loads of all the global columns and rows
+	long long * loads = (long long *) calloc(
+			in->globalWidth + in->globalHeight, sizeof(long long));
+	long long * columnLoads = loads;
+	long long * rowLoads = loads + in->globalWidth;
+	countEntities(in, columnLoads, rowLoads);
+	MPI_Allreduce(MPI_IN_PLACE, loads, in->globalWidth + in->globalHeight,
+			MPI_LONG_LONG, MPI_SUM, in->comm);
+	for (int x = 0; x < in->globalWidth; x++) {
+		columnLoads[x] += in->globalHeight;
+	}
+	for (int y = 0; y < in->globalHeight; y++) {
+		rowLoads[y] += in->globalWidth;
+	}
+	int * columnOffsets = (int *) malloc(
+			sizeof(int) * (in->globalColumns + in->globalRows + 2));
+	int * rowOffsets = columnOffsets + in->globalColumns + 1;
+	balanceLoads(columnLoads, in->globalWidth, in->globalColumns,
+			columnOffsets);
+	balanceLoads(rowLoads, in->globalHeight, in->globalRows, rowOffsets);
+	free(loads);
+
+	// the old parts of all the processes and the new ones
+	int processes = in->globalColumns * in->globalRows;
+	int rank;
+	MPI_Comm_rank(in->comm, &rank);
+	Part * oldParts = (Part *) malloc(sizeof(Part) * 2 * processes);
+	Part * newParts = oldParts + processes;
+	Part local = { in->globalX, in->globalY, in->globalXOffset,
+			in->globalYOffset, in->localWidth, in->localHeight };
+	MPI_Allgather(&local, sizeof(Part), MPI_BYTE, oldParts, sizeof(Part),
+			MPI_BYTE, in->comm);
+	for (int r = 0; r < processes; r++) {
+		Part * part = newParts + r;
+		*part = oldParts[r];
+		part->x = columnOffsets[part->globalX];
+		part->width = columnOffsets[part->globalX + 1] - part->x;
+		part->y = rowOffsets[part->globalY];
+		part->height = rowOffsets[part->globalY + 1] - part->y;
+	}
+	free(columnOffsets);
+
+	// all the processes have the same loads, so they decide the same
+	bool changed = false;
+	for (int r = 0; r < processes; r++) {
+		changed |= newParts[r].x != oldParts[r].x
+				|| newParts[r].y != oldParts[r].y
+				|| newParts[r].width != oldParts[r].width
+				|| newParts[r].height != oldParts[r].height;
+	}
+	double predicted = changed ?
+			predictImbalance(in, oldParts, newParts, processes, rank) :
+			imbalance;
+	if (predicted >= imbalance) {
+		if (first) {
+			LOG_DEBUG("Imbalance %f at %lld would be %f after rebalancing\n",
+					imbalance, in->clock, predicted);
+		}
+		free(oldParts);
+		return;
+	}
+
+	// each process sends the cells which are in the new parts of the others
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(in, bases, sizes);
+	int cellBytes = 0;
+	for (int p = 0; p < CELL_PLANES; p++) {
+		cellBytes += sizes[p];
+	}
+	int * counts = (int *) malloc(sizeof(int) * 4 * processes);
+	int * sendCounts = counts;
+	int * sendOffsets = counts + processes;
+	int * receiveCounts = counts + 2 * processes;
+	int * receiveOffsets = counts + 3 * processes;
+	int sendBytes = 0;
+	int receiveBytes = 0;
+	for (int r = 0; r < processes; r++) {
+		Part common;
+		sendCounts[r] = intersectParts(oldParts + rank, newParts + r, &common)
+				* cellBytes;
+		sendOffsets[r] = sendBytes;
+		sendBytes += sendCounts[r];
+		receiveCounts[r] = intersectParts(oldParts + r, newParts + rank,
+				&common) * cellBytes;
+		receiveOffsets[r] = receiveBytes;
+		receiveBytes += receiveCounts[r];
+	}
+
+	char * sendBuffer = (char *) malloc(sendBytes);
+	char * receiveBuffer = (char *) malloc(receiveBytes);
+	for (int r = 0; r < processes; r++) {
+		Part common;
+		if (intersectParts(oldParts + rank, newParts + r, &common) > 0) {
+			copyPart(in, &common, sendBuffer + sendOffsets[r], true);
+		}
+	}
+	MPI_Alltoallv(sendBuffer, sendCounts, sendOffsets, MPI_BYTE,
+			receiveBuffer, receiveCounts, receiveOffsets, MPI_BYTE, in->comm);
+
+	WorldPtr newInput = newPart(in, newParts + rank);
+	WorldPtr newOutput = newPart(*output, newParts + rank);
+	for (int r = 0; r < processes; r++) {
+		Part common;
+		if (intersectParts(oldParts + r, newParts + rank, &common) > 0) {
+			copyPart(newInput, &common, receiveBuffer + receiveOffsets[r],
+					false);
+		}
+	}
+	refreshBits(newInput, newInput->xStart, newInput->xEnd,
+			newInput->yStart, newInput->yEnd);
+
+	free(sendBuffer);
+	free(receiveBuffer);
+	free(counts);
+	free(oldParts);
+	destroyWorld(*input);
+	destroyWorld(*output);
+	*input = newInput;
+	*output = newOutput;
+
+	long long newEntities;
+	double newImbalance = getImbalance(newInput, &newEntities);
+	double elapsedTime = getElapsedTime(timer);
+	if (first) {
+		LOG_DEBUG("Rebalanced at %lld in %f milliseconds: imbalance %f "
+				"before, %f after (%f predicted), %lld entities before, "
+				"%lld after\n", newInput->clock, elapsedTime, imbalance,
+				newImbalance, predicted, entities, newEntities);
+	}
+	LOG_DEBUG("Part %d x %d at [%d, %d] after rebalancing\n",
+			newInput->localWidth, newInput->localHeight,
+			newInput->globalXOffset, newInput->globalYOffset);
+}
+#endif
@@ -3,6 +3,12 @@
 
 #include "world.h"
 
+/*
+ * The exchanges and the reductions are called by all the threads
+ * of the parallel region of the step (see simulateStep), or outside of one.
+ * Only the master thread calls MPI.
+ */
+
 void sendRecieveBorder(WorldPtr world);
 
 void sendRecieveBorderFinish(WorldPtr world);
@@ -11,7 +17,32 @@ void sendReceiveGhosts(WorldPtr world);
 
 void sendReceiveGhostsFinish(WorldPtr World);
 
+/**
+ * Starts summing up the stats of all the processes into globalStats.
+ * The reduction is finished by sendRecieveBorderFinish
+ * in the next step or by reduceStatsFinish.
+ */
+void reduceStats(WorldPtr world);
+
+/**
+ * Waits for the reduction of the stats of the last step.
+ */
+void reduceStatsFinish(WorldPtr world);
+
 double divideWorld(int * width, int * height, WorldPtr * input,
 		WorldPtr * output);
 
+#ifdef USE_MPI
+/**
+ * Moves the borders between the parts of the world, so the processes
+ * get about the same load, and migrates the cells between them.
+ * The columns and rows of the grid of processes keep their widths
+ * and heights in common, so the neighbours stay the same.
+ * Both worlds are replaced; output must be empty.
+ * Nothing changes unless the imbalance reaches REBALANCE_THRESHOLD
+ * and the new parts are different and would be better balanced.
+ */
+void rebalanceWorld(WorldPtr * input, WorldPtr * output);
+#endif
+
 #endif /* COMMUNICATION_H_ */
@@ -10,12 +10,62 @@
 #include "direction.h"
 #include "random.h"
 
+/**
+ * Scales a random word to [-1, 1).
+ */
+#define WORD_TO_UNIT(word) ((int) (word) * (1.0f / 2147483648.0f))
+
+// getRandomBearings generates the words of this many attempts at once
+#define BEARING_ATTEMPTS 32
+
 bearing getRandomBearing() {
+	// von Neumann: for a point (u, v) in the unit circle,
+	// (u + iv)^2 / (u^2 + v^2) has uniformly distributed angle
+	float u, v, s;
+	do {
+		u = WORD_TO_UNIT(randomWord());
+		v = WORD_TO_UNIT(randomWord());
+		s = u * u + v * v;
+	} while (s > 1 || s < 1e-12f);
+	float scale = 0.5f / s;
+	return (u * u - v * v) * scale + I * (2 * u * v * scale);
+}
+
+void getRandomBearings(bearing * bearings, int count) {
+	// each attempt takes two words; there are never more attempts
+	// than missing bearings, so the words are those getRandomBearing would draw
+	unsigned int words[2 * BEARING_ATTEMPTS];
+	float u[BEARING_ATTEMPTS];
+	float v[BEARING_ATTEMPTS];
+	float s[BEARING_ATTEMPTS];
+	int i = 0;
+	while (i < count) {
+		int attempts = count - i < BEARING_ATTEMPTS ?
+				count - i : BEARING_ATTEMPTS;
+		randomWords(words, 2 * attempts);
+		// the points of all the attempts first, this loop can be vectorised
+		for (int a = 0; a < attempts; a++) {
+			u[a] = WORD_TO_UNIT(words[2 * a]);
+			v[a] = WORD_TO_UNIT(words[2 * a + 1]);
+			s[a] = u[a] * u[a] + v[a] * v[a];
+		}
+		for (int a = 0; a < attempts; a++) {
+			if (s[a] > 1 || s[a] < 1e-12f) {
+				continue;
+			}
+			float scale = 0.5f / s[a];
+			bearings[i++] = (u[a] * u[a] - v[a] * v[a]) * scale
+					+ I * (2 * u[a] * v[a] * scale);
+		}
+	}
+}
+
+bearing getRandomBearingDirect() {
 	float angle = randomDouble() * 100 * M_PI;
 	return 0.5 * cexpf(I * angle);
 }
 
-Direction bearingToDirection(bearing bearing) {
+Direction bearingToDirectionDirect(bearing bearing) {
 	if (cabs(bearing) < 1) {
 		return STAY;
 	}
@@ -32,3 +82,30 @@ Direction bearingToDirection(bearing bearing) {
 		return LEFT;
 	}
 }
+
+#ifdef COMPACT_ENTITY
+bearing packedBearingAngles[1 << PACKED_BEARING_ANGLE_BITS];
+
+void initPackedBearings() {
+	for (int i = 0; i < 1 << PACKED_BEARING_ANGLE_BITS; i++) {
+		packedBearingAngles[i] = cexpf(
+				I * (2 * M_PI * i / (1 << PACKED_BEARING_ANGLE_BITS)));
+	}
+}
+
+PackedBearing packBearing(bearing bearing_) {
+	int abs = lrintf(
+			cabsf(bearing_) * ((1 << PACKED_BEARING_ABS_BITS) / PACKED_BEARING_MAX));
+	if (abs == 0) {
+		return 0;
+	}
+	if (abs >= 1 << PACKED_BEARING_ABS_BITS) {
+		abs = (1 << PACKED_BEARING_ABS_BITS) - 1;
+	}
+	// cargf is in [-PI, PI], the negative angles wrap around
+	int angle = lrintf(cargf(bearing_)
+			* ((1 << PACKED_BEARING_ANGLE_BITS) / (2 * M_PI)))
+			& ((1 << PACKED_BEARING_ANGLE_BITS) - 1);
+	return angle << PACKED_BEARING_ABS_BITS | abs;
+}
+#endif
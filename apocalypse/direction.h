@@ -9,6 +9,7 @@
 #define DIRECTION_H_
 
 #include <complex.h>
+#include <math.h>
 
 /**
  * Mapping names to indices of directions.
@@ -87,6 +88,42 @@ typedef float complex bearing;
  */
 #define NO_BEARING ((const bearing) (0+0*I))
 
+#ifdef COMPACT_ENTITY
+/**
+ * A bearing quantised into 16 bits: the high 10 bits are the angle
+ * and the low 6 bits the absolute value in [0, PACKED_BEARING_MAX).
+ * Stored bearings are shorter than
+ * BEARING_ABS_QUOTIENT_MEAN + BEARING_ABS_QUOTIENT_VARIANCE / 2 = 1.125.
+ */
+typedef unsigned short PackedBearing;
+
+#define PACKED_BEARING_ANGLE_BITS 10
+#define PACKED_BEARING_ABS_BITS 6
+#define PACKED_BEARING_MAX 1.25f
+
+/**
+ * Unit bearings of all the packed angles, see initPackedBearings.
+ */
+extern bearing packedBearingAngles[1 << PACKED_BEARING_ANGLE_BITS];
+
+/**
+ * Builds the table used by unpackBearing.
+ * This function must be called once when the program starts.
+ */
+void initPackedBearings();
+
+/**
+ * Quantises the bearing.
+ */
+PackedBearing packBearing(bearing bearing_);
+
+static inline bearing unpackBearing(PackedBearing packed) {
+	int abs = packed & ((1 << PACKED_BEARING_ABS_BITS) - 1);
+	return packedBearingAngles[packed >> PACKED_BEARING_ABS_BITS]
+			* (abs * (PACKED_BEARING_MAX / (1 << PACKED_BEARING_ABS_BITS)));
+}
+#endif
+
 /**
  * Returns random bearing in terms of random angle and absolute value = 0.5.
  * This is intentional to map any random bearing to
@@ -94,6 +131,18 @@ typedef float complex bearing;
  */
 bearing getRandomBearing();
 
+/**
+ * Fills the array with random bearings.
+ * The same bearings would be returned by the repeated calls of getRandomBearing.
+ */
+void getRandomBearings(bearing * bearings, int count);
+
+/**
+ * The original getRandomBearing which uses cexpf.
+ * It is kept as the reference for the benchmark.
+ */
+bearing getRandomBearingDirect();
+
 /**
  * Converts a direction to bearing.
  * This function is useful when iterating over directions.
@@ -101,12 +150,44 @@ bearing getRandomBearing();
 #define BEARING_FROM_DIRECTION(direction) \
 	(direction_delta_x[direction] + I * direction_delta_y[direction])
 
+/**
+ * The original bearingToDirection which uses cabs and cargf.
+ * It is kept as the reference for the benchmark.
+ */
+Direction bearingToDirectionDirect(bearing bearing);
+
 /**
  * Converts bearing to direction.
  * The plane is divided into 5 parts.
  * In the middle, the circle with radius = 1 is considered STAY.
  * The rest is divided as the letter X - LEFT, UP, RIGHT and DOWN.
+ *
+ * Only the parts are compared, without cabs and cargf.
+ * Close to the diagonals, the sector depends on how cargf rounds the angle,
+ * so these rare bearings are passed to bearingToDirectionDirect.
  */
-Direction bearingToDirection(bearing bearing);
+#define BEARING_DIAGONAL_LOW (1 - 0x1p-20)
+#define BEARING_DIAGONAL_HIGH (1 + 0x1p-20)
+
+static inline Direction bearingToDirection(bearing bearing_) {
+	float re = crealf(bearing_);
+	float im = cimagf(bearing_);
+	// the squares are exact in double
+	if ((double) re * re + (double) im * im < 1) {
+		return STAY;
+	}
+	double absRe = fabsf(re);
+	double absIm = fabsf(im);
+	if (absIm >= absRe * BEARING_DIAGONAL_LOW
+			&& absIm <= absRe * BEARING_DIAGONAL_HIGH) {
+		return bearingToDirectionDirect(bearing_);
+	}
+	// note that negative imaginary part means UP
+	if (absIm > absRe) {
+		return im > 0 ? DOWN : UP;
+	} else {
+		return re > 0 ? RIGHT : LEFT;
+	}
+}
 
 #endif /* DIRECTION_H_ */
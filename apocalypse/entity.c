@@ -92,11 +92,14 @@ void newHuman(EntityPtr human, simClock clock) {
 	}
 
 	// may or may not be in future
-	human->fertilityStart = MAX(1, fertilityStart);
-	human->fertilityEnd = MAX(fertilityStart, fertilityEnd);
+	human->fertilityStart = SATURATE_DELTA(MAX(1, fertilityStart));
+	human->fertilityEnd = SATURATE_DELTA(MAX(fertilityStart, fertilityEnd));
 
 	human->bearing = getRandomBearing();
 	human->becameInfected = 0;
+#ifdef EVENT_LIFECYCLE
+	scheduleLifecycle(human, clock);
+#endif
 }
 
 void newZombie(EntityPtr zombie, simClock clock) {
@@ -109,11 +112,17 @@ void newZombie(EntityPtr zombie, simClock clock) {
 	zombie->fertilityStart = 0;
 	zombie->fertilityEnd = 0;
 	zombie->becameInfected = 0;
+#ifdef EVENT_LIFECYCLE
+	scheduleLifecycle(zombie, clock);
+#endif
 }
 
 void toInfected(EntityPtr infected, simClock clock) {
 	infected->type = INFECTED;
-	infected->becameInfected = clock - infected->origin;
+	infected->becameInfected = SATURATE_DELTA(clock - infected->origin);
+#ifdef EVENT_LIFECYCLE
+	scheduleLifecycle(infected, clock);
+#endif
 }
 
 void toZombie(EntityPtr zombie, simClock clock) {
@@ -127,24 +136,25 @@ void toZombie(EntityPtr zombie, simClock clock) {
 	zombie->fertilityStart = 0;
 	zombie->fertilityEnd = 0;
 	zombie->becameInfected = 0;
+#ifdef EVENT_LIFECYCLE
+	scheduleLifecycle(zombie, clock);
+#endif
 }
 
-void makeLove(EntityPtr mother, EntityPtr father, simClock clock, Stats stats) {
-	double rnd = randomDouble();
-
+double getFertilizationProbability(const Stats * stats) {
 #ifdef UNCONTROLLED_BIRTH
-	double prob = PROBABILITY_FERTILIZATION;
+	return PROBABILITY_FERTILIZATION;
 #elif EQUAL_BIRTH
-	int died = stats.humanFemalesDied + stats.humanMalesDied
-	+ stats.infectedFemalesDied + stats.infectedMalesDied
-	+ stats.infectedFemalesBecameZombies
-	+ stats.infectedMalesBecameZombies;
-	int couples = stats.couplesMakingLove;
-	double prob = couples == 0 ? 1 : died / couples;
+	long long died = stats->humanFemalesDied + stats->humanMalesDied
+	+ stats->infectedFemalesDied + stats->infectedMalesDied
+	+ stats->infectedFemalesBecameZombies
+	+ stats->infectedMalesBecameZombies;
+	long long couples = stats->couplesMakingLove;
+	return couples == 0 ? 1 : died / couples;
 #else // controlled by density
-	int population = stats.humanFemales + stats.humanMales
-			+ stats.infectedFemales + stats.infectedMales;
-	double density = population / ((double) stats.width * stats.height);
+	long long population = stats->humanFemales + stats->humanMales
+			+ stats->infectedFemales + stats->infectedMales;
+	double density = population / ((double) stats->width * stats->height);
 	double ratio = INITIAL_DENSITY / density;
 #ifdef DENSITY_BIRTH
 	double q = ratio;
@@ -152,9 +162,14 @@ void makeLove(EntityPtr mother, EntityPtr father, simClock clock, Stats stats) {
 	double exp = ratio * SITUATION_AWARENESS_COEFFICIENT;
 	double q = pow(ratio, exp);
 #endif
-	double prob = PROBABILITY_FERTILIZATION * q;
+	return PROBABILITY_FERTILIZATION * q;
 #endif
-	if (rnd > prob) {
+}
+
+void makeLove(EntityPtr mother, EntityPtr father, simClock clock,
+		double fertilization) {
+	double rnd = randomDouble();
+	if (rnd > fertilization) {
 		return;
 	}
 
@@ -202,82 +217,201 @@ Entity giveBirth(EntityPtr mother, simClock clock) {
 	}
 
 	born.origin = clock;
-	born.fertilityStart = fertilityStart;
-	born.fertilityEnd = fertilityEnd;
+	born.fertilityStart = SATURATE_DELTA(fertilityStart);
+	born.fertilityEnd = SATURATE_DELTA(fertilityEnd);
 
 	born.bearing = NO_BEARING;
 	born.children = 0;
 	born.borns = 0;
+#ifdef EVENT_LIFECYCLE
+	scheduleLifecycle(&born, clock);
+#endif
 
 	// decrease number of unborn children
 	mother->children--;
 	return born;
 }
 
+/**
+ * Age classes of humans (and infected) and of zombies.
+ */
+#define HUMAN_AGE_CLASSES 4 // child, young, middle-aged, elderly
+#define ZOMBIE_AGE_CLASSES 2 // young, old
+
+/**
+ * The parameters of the age classes, indexed by gender and class.
+ * They are initialised from constants.h at compile time.
+ */
+static const double humanSpeeds[2][HUMAN_AGE_CLASSES] = { //
+		[MALE] = { SPEED_MALE_CHILD, SPEED_MALE_YOUNG, SPEED_MALE_MIDDLEAGE,
+		SPEED_MALE_ELDERLY }, //
+		[FEMALE] = { SPEED_FEMALE_CHILD, SPEED_FEMALE_YOUNG,
+		SPEED_FEMALE_MIDDLEAGE, SPEED_FEMALE_ELDERLY } };
+
+static const double deathRates[2][HUMAN_AGE_CLASSES] = { //
+		[MALE] = { PROBABILITY_MALE_CHILD_DEATH, PROBABILITY_MALE_YOUNG_DEATH,
+		PROBABILITY_MALE_MIDDLEAGE_DEATH, PROBABILITY_MALE_ELDERLY_DEATH }, //
+		[FEMALE] = { PROBABILITY_FEMALE_CHILD_DEATH,
+		PROBABILITY_FEMALE_YOUNG_DEATH, PROBABILITY_FEMALE_MIDDLEAGE_DEATH,
+		PROBABILITY_FEMALE_ELDERLY_DEATH } };
+
+static const RandomThreshold speedThresholds[2][HUMAN_AGE_CLASSES] = { //
+		[MALE] = { RANDOM_THRESHOLD(SPEED_MALE_CHILD),
+		RANDOM_THRESHOLD(SPEED_MALE_YOUNG),
+		RANDOM_THRESHOLD(SPEED_MALE_MIDDLEAGE),
+		RANDOM_THRESHOLD(SPEED_MALE_ELDERLY) }, //
+		[FEMALE] = { RANDOM_THRESHOLD(SPEED_FEMALE_CHILD),
+		RANDOM_THRESHOLD(SPEED_FEMALE_YOUNG),
+		RANDOM_THRESHOLD(SPEED_FEMALE_MIDDLEAGE),
+		RANDOM_THRESHOLD(SPEED_FEMALE_ELDERLY) } };
+
+static const RandomThreshold deathThresholds[2][HUMAN_AGE_CLASSES] = { //
+		[MALE] = { RANDOM_THRESHOLD(PROBABILITY_MALE_CHILD_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_MALE_YOUNG_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_MALE_MIDDLEAGE_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_MALE_ELDERLY_DEATH) }, //
+		[FEMALE] = { RANDOM_THRESHOLD(PROBABILITY_FEMALE_CHILD_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_FEMALE_YOUNG_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_FEMALE_MIDDLEAGE_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_FEMALE_ELDERLY_DEATH) } };
+
+static const double zombieSpeeds[ZOMBIE_AGE_CLASSES] = { SPEED_ZOMBIE_YOUNG,
+SPEED_ZOMBIE_OLD };
+
+static const RandomThreshold zombieSpeedThresholds[ZOMBIE_AGE_CLASSES] = {
+		RANDOM_THRESHOLD(SPEED_ZOMBIE_YOUNG), RANDOM_THRESHOLD(SPEED_ZOMBIE_OLD) };
+
+static const double decompositionRates[ZOMBIE_AGE_CLASSES] = {
+PROBABILITY_ZOMBIE_YOUNG_DEATH, PROBABILITY_ZOMBIE_OLD_DEATH };
+
+static const RandomThreshold decompositionThresholds[ZOMBIE_AGE_CLASSES] = {
+		RANDOM_THRESHOLD(PROBABILITY_ZOMBIE_YOUNG_DEATH),
+		RANDOM_THRESHOLD(PROBABILITY_ZOMBIE_OLD_DEATH) };
+
+/**
+ * Returns the age class of the living entity at given time.
+ * The comparisons are summed, so there are no branches.
+ */
+static inline int getHumanAgeClass(EntityPtr living, simClock currentTime) {
+	simClock age = currentTime - living->origin;
+	return (age >= HUMAN_CHILD_YOUNG_BORDER)
+			+ (age >= HUMAN_YOUNG_MIDDLEAGE_BORDER)
+			+ (age >= HUMAN_MIDDLEAGE_ELDERLY_BORDER);
+}
+
+/**
+ * Returns the age class of the zombie at given time.
+ */
+static inline int getZombieAgeClass(EntityPtr zombie, simClock currentTime) {
+	return currentTime - zombie->origin >= ZOMBIE_YOUNG_OLD_BORDER;
+}
+
 double getMaxSpeed(EntityPtr entity, simClock currentTime) {
 	if (entity->type == ZOMBIE) {
-		int age = currentTime - entity->origin;
-		if (age < ZOMBIE_YOUNG_OLD_BORDER) {
-			return SPEED_ZOMBIE_YOUNG;
-		} else {
-			return SPEED_ZOMBIE_OLD;
-		}
+		return zombieSpeeds[getZombieAgeClass(entity, currentTime)];
 	} else {
-		int age = currentTime - entity->origin;
-		if (entity->gender == FEMALE) {
-			if (age < HUMAN_CHILD_YOUNG_BORDER) {
-				return SPEED_FEMALE_CHILD;
-			} else if (age < HUMAN_YOUNG_MIDDLEAGE_BORDER) {
-				return SPEED_FEMALE_YOUNG;
-			} else if (age < HUMAN_MIDDLEAGE_ELDERLY_BORDER) {
-				return SPEED_FEMALE_MIDDLEAGE;
-			} else {
-				return SPEED_FEMALE_ELDERLY;
-			}
-		} else {
-			if (age < HUMAN_CHILD_YOUNG_BORDER) {
-				return SPEED_MALE_CHILD;
-			} else if (age < HUMAN_YOUNG_MIDDLEAGE_BORDER) {
-				return SPEED_MALE_YOUNG;
-			} else if (age < HUMAN_MIDDLEAGE_ELDERLY_BORDER) {
-				return SPEED_MALE_MIDDLEAGE;
-			} else {
-				return SPEED_MALE_ELDERLY;
-			}
-		}
+		return humanSpeeds[entity->gender][getHumanAgeClass(entity,
+				currentTime)];
 	}
 }
 
-double getDeathRate(EntityPtr living, simClock currentTime) {
-	int age = currentTime - living->origin;
-	if (living->gender == FEMALE) {
-		if (age < HUMAN_CHILD_YOUNG_BORDER) {
-			return PROBABILITY_FEMALE_CHILD_DEATH;
-		} else if (age < HUMAN_YOUNG_MIDDLEAGE_BORDER) {
-			return PROBABILITY_FEMALE_YOUNG_DEATH;
-		} else if (age < HUMAN_MIDDLEAGE_ELDERLY_BORDER) {
-			return PROBABILITY_FEMALE_MIDDLEAGE_DEATH;
-		} else {
-			return PROBABILITY_FEMALE_ELDERLY_DEATH;
-		}
+RandomThreshold getSpeedThreshold(EntityPtr entity, simClock currentTime) {
+	if (entity->type == ZOMBIE) {
+		return zombieSpeedThresholds[getZombieAgeClass(entity, currentTime)];
 	} else {
-		if (age < HUMAN_CHILD_YOUNG_BORDER) {
-			return PROBABILITY_MALE_CHILD_DEATH;
-		} else if (age < HUMAN_YOUNG_MIDDLEAGE_BORDER) {
-			return PROBABILITY_MALE_YOUNG_DEATH;
-		} else if (age < HUMAN_MIDDLEAGE_ELDERLY_BORDER) {
-			return PROBABILITY_MALE_MIDDLEAGE_DEATH;
-		} else {
-			return PROBABILITY_MALE_ELDERLY_DEATH;
-		}
+		return speedThresholds[entity->gender][getHumanAgeClass(entity,
+				currentTime)];
 	}
 }
 
+double getDeathRate(EntityPtr living, simClock currentTime) {
+	return deathRates[living->gender][getHumanAgeClass(living, currentTime)];
+}
+
+RandomThreshold getDeathThreshold(EntityPtr living, simClock currentTime) {
+	return deathThresholds[living->gender][getHumanAgeClass(living,
+			currentTime)];
+}
+
 double getDecompositionRate(EntityPtr zombie, simClock currentTime) {
-	int age = currentTime - zombie->origin;
-	if (age < ZOMBIE_YOUNG_OLD_BORDER) {
-		return PROBABILITY_ZOMBIE_YOUNG_DEATH;
+	return decompositionRates[getZombieAgeClass(zombie, currentTime)];
+}
+
+RandomThreshold getDecompositionThreshold(EntityPtr zombie,
+		simClock currentTime) {
+	return decompositionThresholds[getZombieAgeClass(zombie, currentTime)];
+}
+
+#ifdef EVENT_LIFECYCLE
+/**
+ * Returns the age at which the age class of the entity ends
+ * and so its hazard changes; -1 if it never changes.
+ */
+static simClock getClassEnd(EntityPtr entity, simClock age) {
+	if (entity->type == ZOMBIE) {
+		return age < ZOMBIE_YOUNG_OLD_BORDER ? ZOMBIE_YOUNG_OLD_BORDER : -1;
+	}
+	if (age < HUMAN_CHILD_YOUNG_BORDER) {
+		return HUMAN_CHILD_YOUNG_BORDER;
+	} else if (age < HUMAN_YOUNG_MIDDLEAGE_BORDER) {
+		return HUMAN_YOUNG_MIDDLEAGE_BORDER;
+	} else if (age < HUMAN_MIDDLEAGE_ELDERLY_BORDER) {
+		return HUMAN_MIDDLEAGE_ELDERLY_BORDER;
 	} else {
-		return PROBABILITY_ZOMBIE_OLD_DEATH;
+		return -1;
 	}
 }
+
+/**
+ * Returns probability of the lifecycle event of the entity in one step.
+ * For infected it is either death or zombification.
+ */
+static double getLifecycleRate(EntityPtr entity, simClock currentTime) {
+	switch (entity->type) {
+	case HUMAN:
+		return getDeathRate(entity, currentTime);
+	case INFECTED: {
+		double death = getDeathRate(entity, currentTime);
+		return death + PROBABILITY_BECOME_ZOMBIE
+				- death * PROBABILITY_BECOME_ZOMBIE;
+	}
+	case ZOMBIE:
+		return getDecompositionRate(entity, currentTime);
+	default:
+		return 0;
+	}
+}
+
+void scheduleLifecycle(EntityPtr entity, simClock clock) {
+	// the first step in which the event can happen
+	simClock next = clock + 1;
+	double rate = getLifecycleRate(entity, next);
+
+	// the event is never later than the end of the horizon or the age class
+	simClock limit = LIFECYCLE_HORIZON;
+	simClock classEnd = getClassEnd(entity, next - entity->origin);
+	if (classEnd >= 0) {
+		limit = MIN(limit, entity->origin + classEnd - next);
+	}
+	limit = MAX(limit, 1);
+
+	// number of steps without the event is geometric
+	double steps;
+	if (rate >= 1) {
+		steps = 0;
+	} else if (rate <= 0) {
+		steps = limit;
+	} else {
+		double u = 1 - randomDouble(); // (0, 1]
+		steps = floor(log(u) / log1p(-rate));
+	}
+
+	if (steps < limit) {
+		entity->event = LIFECYCLE_CLOCK(next + (simClock) steps);
+		entity->eventDue = 1;
+	} else {
+		entity->event = LIFECYCLE_CLOCK(next + limit);
+		entity->eventDue = 0;
+	}
+}
+#endif
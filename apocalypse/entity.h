@@ -8,6 +8,7 @@
 #include "clock.h"
 #include "direction.h"
 #include "stats.h"
+#include "random.h"
 
 /**
  * Entity may be of type HUMAN, INFECTED, ZOMBIE or NONE.
@@ -31,21 +32,57 @@ typedef enum Gender {
  * it also constraints us to simulation of 2^31 steps and maximal age 2^21 steps.
  * Which is for 1 step a day: 5883516 years of simulation and 5745 years of age.
  */
+#ifdef EVENT_LIFECYCLE
+/**
+ * The deltas are cut to 16 bits to make space for the scheduled event.
+ */
+#define DELTA_BITS 16
+
+/**
+ * The scheduled event is stored as the lowest 16 bits of its clock.
+ * Every entity is simulated in every step, so the clock is reached exactly;
+ * events further than LIFECYCLE_HORIZON steps are rescheduled on the way.
+ */
+#define LIFECYCLE_HORIZON 0xFFFF
+#define LIFECYCLE_CLOCK(clock) ((clock) & LIFECYCLE_HORIZON)
+
+/**
+ * Deltas which do not fit into the entity are saturated.
+ */
+#define SATURATE_DELTA(delta) \
+	((delta) < (1ULL << DELTA_BITS) ? (delta) : (1ULL << DELTA_BITS) - 1)
+#else
+#define DELTA_BITS 21
+
+#define SATURATE_DELTA(delta) (delta)
+#endif
+
 typedef struct Entity {
 	// this group has 32 bits in total; last 6 bits is padding
 	EntityType type :2; // 0, 1, 2, 3
 	Gender gender :1; // 0, 1
 	unsigned int children :2; // 0, 1, 2, 3
 	simClockDelta borns :21;
+#ifdef EVENT_LIFECYCLE
+	// the event is death, decomposition or zombification,
+	// otherwise the hazard changes at the event and it is rescheduled
+	unsigned int eventDue :1;
+	unsigned :5; // 5 bits are free
+#else
 	unsigned :6; // 6 bits are free
+#endif
 
 	simClock origin :32;
 	unsigned :0;
 
 	// these 3 delta clocks are 63 bits + 1 bit padding
-	simClockDelta fertilityStart :21;
-	simClockDelta fertilityEnd :21;
-	simClockDelta becameInfected :21;
+	// or 48 bits + 16 bits of the scheduled event
+	simClockDelta fertilityStart :DELTA_BITS;
+	simClockDelta fertilityEnd :DELTA_BITS;
+	simClockDelta becameInfected :DELTA_BITS;
+#ifdef EVENT_LIFECYCLE
+	simClockDelta event :16; // LIFECYCLE_CLOCK of the next lifecycle event
+#endif
 	unsigned :0;
 
 	bearing bearing; // size is 2*sizeof(float) = 8
@@ -53,6 +90,96 @@ typedef struct Entity {
 
 typedef Entity * EntityPtr;
 
+#ifdef COMPACT_ENTITY
+/**
+ * Compact encoding of an Entity which is used to store it in the world.
+ * It is 16 Bytes long: the deltas are cut to 16 bits,
+ * which is 179 years of age, and the bearing is quantised (PackedBearing).
+ * Use packEntity and unpackEntity to convert it.
+ */
+#define STORED_DELTA_BITS 16
+
+typedef struct CompactEntity {
+	EntityType type :2;
+	Gender gender :1;
+	unsigned int children :2;
+	unsigned int borns :STORED_DELTA_BITS;
+#ifdef EVENT_LIFECYCLE
+	unsigned int eventDue :1;
+#endif
+	unsigned :0;
+
+	int origin;
+
+	unsigned int fertilityStart :STORED_DELTA_BITS;
+	unsigned int fertilityEnd :STORED_DELTA_BITS;
+
+#ifdef EVENT_LIFECYCLE
+	// becameInfected is not stored, nothing reads it
+	unsigned int event :16;
+#else
+	unsigned int becameInfected :STORED_DELTA_BITS;
+#endif
+	PackedBearing bearing;
+} CompactEntity;
+
+typedef PackedBearing StoredBearing;
+
+#define STORE_BEARING(bearing_) packBearing(bearing_)
+#define LOAD_BEARING(stored) unpackBearing(stored)
+
+/**
+ * Deltas which do not fit are saturated.
+ */
+#define STORE_DELTA(delta) \
+	((delta) < (1ULL << STORED_DELTA_BITS) ? (delta) \
+			: (1ULL << STORED_DELTA_BITS) - 1)
+
+static inline void packEntity(CompactEntity * compact, EntityPtr entity) {
+	compact->type = entity->type;
+	compact->gender = entity->gender;
+	compact->children = entity->children;
+	compact->borns = STORE_DELTA(entity->borns);
+	compact->origin = entity->origin;
+	compact->fertilityStart = STORE_DELTA(entity->fertilityStart);
+	compact->fertilityEnd = STORE_DELTA(entity->fertilityEnd);
+#ifdef EVENT_LIFECYCLE
+	compact->eventDue = entity->eventDue;
+	compact->event = entity->event;
+#else
+	compact->becameInfected = STORE_DELTA(entity->becameInfected);
+#endif
+	compact->bearing = packBearing(entity->bearing);
+}
+
+static inline void unpackEntity(EntityPtr entity,
+		const CompactEntity * compact) {
+	entity->type = compact->type;
+	entity->gender = compact->gender;
+	entity->children = compact->children;
+	entity->borns = compact->borns;
+	entity->origin = compact->origin;
+	entity->fertilityStart = compact->fertilityStart;
+	entity->fertilityEnd = compact->fertilityEnd;
+#ifdef EVENT_LIFECYCLE
+	entity->becameInfected = 0;
+	entity->eventDue = compact->eventDue;
+	entity->event = compact->event;
+#else
+	entity->becameInfected = compact->becameInfected;
+#endif
+	entity->bearing = unpackBearing(compact->bearing);
+}
+#else
+#define STORED_DELTA_BITS DELTA_BITS
+
+typedef bearing StoredBearing;
+
+#define STORE_BEARING(bearing_) (bearing_)
+#define LOAD_BEARING(stored) (stored)
+#define STORE_DELTA(delta) SATURATE_DELTA(delta)
+#endif
+
 /**
  * Use only at the start of the simulation (clock should be 0)
  * Creates a new random human who was born prior to start of the simulation.
@@ -77,12 +204,20 @@ void toInfected(EntityPtr infected, simClock clock);
  */
 void toZombie(EntityPtr zombie, simClock clock);
 
+/**
+ * Returns the probability of fertilization for the step after the one
+ * with given stats. It depends on the birth control which is compiled in.
+ * Compute it once per step and pass it to makeLove.
+ */
+double getFertilizationProbability(const Stats * stats);
+
 /**
  * Conceives up to three children in mother's body.
  * The fertilization will happen with a probability.
  * Call this whenever a MALE is next to a FEMALE.
  */
-void makeLove(EntityPtr mother, EntityPtr father, simClock clock, Stats stats);
+void makeLove(EntityPtr mother, EntityPtr father, simClock clock,
+		double fertilization);
 
 /**
  * Mother gives birth to all her children when they are scheduled.
@@ -91,21 +226,47 @@ void makeLove(EntityPtr mother, EntityPtr father, simClock clock, Stats stats);
  */
 Entity giveBirth(EntityPtr mother, simClock clock);
 
+#ifdef EVENT_LIFECYCLE
+/**
+ * Samples the time of the next lifecycle event of the entity
+ * (death, decomposition or zombification) from its current hazard.
+ * The event is scheduled after the clock; if the hazard changes sooner
+ * (the entity moves to the next age class), the change is scheduled instead.
+ */
+void scheduleLifecycle(EntityPtr entity, simClock clock);
+#endif
+
 /**
  * Returns maximal speed which the entity can go.
  */
 double getMaxSpeed(EntityPtr entity, simClock clock);
 
+/**
+ * Returns getMaxSpeed as a threshold for RANDOM_CHANCE.
+ */
+RandomThreshold getSpeedThreshold(EntityPtr entity, simClock clock);
+
 /**
  * Returns probability of death for a living entity at given time.
  */
 double getDeathRate(EntityPtr living, simClock currentTime);
 
+/**
+ * Returns getDeathRate as a threshold for RANDOM_CHANCE.
+ */
+RandomThreshold getDeathThreshold(EntityPtr living, simClock currentTime);
+
 /**
  * Returns probability of decomposition of zombie at given time.
  */
 double getDecompositionRate(EntityPtr zombie, simClock currentTime);
 
+/**
+ * Returns getDecompositionRate as a threshold for RANDOM_CHANCE.
+ */
+RandomThreshold getDecompositionThreshold(EntityPtr zombie,
+		simClock currentTime);
+
 #endif /* ENTITY_H_ */
 
 // vim: ts=4 sw=4 et
@@ -0,0 +1,598 @@
+#include <stddef.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "halo.h"
+#include "common.h"
+#include "log.h"
+
+#ifdef USE_MPI
+/**
+ * Copies one cell of a plane. Constant sizes let the compiler
+ * copy by words instead of calling memcpy.
+ */
+static inline void copyCellBytes(char * dest, const char * src, size_t size) {
+	switch (size) {
+	case 1:
+		*dest = *src;
+		break;
+	case 4:
+		memcpy(dest, src, 4);
+		break;
+	case 8:
+		memcpy(dest, src, 8);
+		break;
+	case 16:
+		memcpy(dest, src, 16);
+		break;
+	case 24:
+		memcpy(dest, src, 24);
+		break;
+	default:
+		memcpy(dest, src, size);
+		break;
+	}
+}
+
+/**
+ * Returns the index of the i-th cell of the line of the side,
+ * which starts at [x, y].
+ */
+static inline CellIndex getLineCell(WorldPtr world, HaloSide * s, bool rows,
+		int x, int y, int line, int i) {
+	return rows ? CELL_INDEX(world, x + i, y + line * s->lineStep) :
+			CELL_INDEX(world, x + line * s->lineStep, y + i);
+}
+
+/**
+ * Copies the lines of one side between the world and the dense buffer.
+ * The buffer holds the planes one after another,
+ * each of them the lines one after another.
+ * Columns are contiguous in the world. Rows are gathered cell by cell,
+ * the cells of all the lines in one column at once as they are adjacent.
+ */
+static void copyLines(WorldPtr world, Halo * halo, int side, bool pack,
+		char * buffer) {
+	HaloSide * s = halo->sides + side;
+	bool rows = side == HALO_UP || side == HALO_DOWN;
+	int x = pack ? s->sendX : s->receiveX;
+	int y = pack ? s->sendY : s->receiveY;
+
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+
+	for (int p = 0; p < CELL_PLANES; p++) {
+		size_t size = sizes[p];
+		char * first = (char *) bases[p] + CELL_INDEX(world, x, y) * size;
+		if (rows) {
+			size_t columnStep = world->stride * size;
+			ptrdiff_t lineStep = s->lineStep * (ptrdiff_t) size;
+			size_t packedLine = s->length * size;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+			for (int i = 0; i < s->length; i++) {
+				char * cell = first + i * columnStep;
+				char * packed = buffer + i * size;
+				for (int l = 0; l < halo->lines; l++) {
+					if (pack) {
+						copyCellBytes(packed, cell, size);
+					} else {
+						copyCellBytes(cell, packed, size);
+					}
+					cell += lineStep;
+					packed += packedLine;
+				}
+			}
+		} else {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+			for (int l = 0; l < halo->lines; l++) {
+				char * cells = first + l * s->lineStep
+						* (ptrdiff_t) (world->stride * size);
+				char * packed = buffer + l * s->length * size;
+				memcpy(pack ? packed : cells, pack ? cells : packed,
+						s->length * size);
+			}
+		}
+		buffer += halo->lines * s->length * size;
+	}
+}
+
+/**
+ * Computes the position of the first occupied cell of each word
+ * of the bitmap among all the occupied cells. Returns their count.
+ */
+static int countOccupied(HaloSide * s, const BitWord * bitmap, int words) {
+	int occupied = 0;
+	for (int w = 0; w < words; w++) {
+		s->wordOffsets[w] = occupied;
+		occupied += __builtin_popcountll(bitmap[w]);
+	}
+	return occupied;
+}
+
+/**
+ * Copies the occupied cells of one side between the world
+ * and the sparse buffer. The buffer holds the occupancy bitmap,
+ * one word after another for each line, and then the occupied cells
+ * of each plane. When unpacking, the first plane of the unoccupied cells
+ * is zeroed, which makes them NONE in both layouts.
+ */
+static void copyOccupied(WorldPtr world, Halo * halo, int side, bool pack,
+		const BitWord * bitmap, int occupied) {
+	HaloSide * s = halo->sides + side;
+	bool rows = side == HALO_UP || side == HALO_DOWN;
+	int x = pack ? s->sendX : s->receiveX;
+	int y = pack ? s->sendY : s->receiveY;
+	int lineWords = (s->length + BITS_IN_WORD - 1) / BITS_IN_WORD;
+	int words = halo->lines * lineWords;
+	char * cells = (char *) (bitmap + words);
+
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+	for (int w = 0; w < words; w++) {
+		int line = w / lineWords;
+		int first = (w % lineWords) * BITS_IN_WORD;
+		if (!pack) {
+			int last = MIN(first + BITS_IN_WORD, s->length);
+			for (int i = first; i < last; i++) {
+				CellIndex index = getLineCell(world, s, rows, x, y, line, i);
+				memset((char *) bases[0] + index * sizes[0], 0, sizes[0]);
+			}
+		}
+		int k = s->wordOffsets[w];
+		BitWord bits = bitmap[w];
+		while (bits != 0) {
+			int i = first + LOWEST_BIT(bits);
+			bits &= bits - 1;
+			CellIndex index = getLineCell(world, s, rows, x, y, line, i);
+			char * planeCells = cells;
+			for (int p = 0; p < CELL_PLANES; p++) {
+				char * cell = (char *) bases[p] + index * sizes[p];
+				char * packed = planeCells + k * sizes[p];
+				if (pack) {
+					copyCellBytes(packed, cell, sizes[p]);
+				} else {
+					copyCellBytes(cell, packed, sizes[p]);
+				}
+				planeCells += occupied * sizes[p];
+			}
+			k++;
+		}
+	}
+}
+
+/**
+ * Returns the occupancy of the cells of one word of the bitmap.
+ * The bits are read from the occupied plane, which is valid
+ * for the lines which are sent.
+ */
+static BitWord getOccupancy(WorldPtr world, HaloSide * s, bool rows,
+		int line, int first) {
+	int count = MIN(BITS_IN_WORD, s->length - first);
+	CellIndex index = getLineCell(world, s, rows, s->sendX, s->sendY, line,
+			first);
+	BitWord bits = 0;
+	if (rows) {
+		for (int i = 0; i < count; i++) {
+			if (TEST_BIT(world->occupiedBits, index + i * world->stride)) {
+				bits |= 1ULL << i;
+			}
+		}
+	} else {
+		// getBits reads at most 57 bits, so a word is read by halves
+		int low = MIN(count, BITS_IN_WORD / 2);
+		bits = getBits(world->occupiedBits, index, low);
+		if (count > low) {
+			bits |= getBits(world->occupiedBits, index + low, count - low)
+					<< low;
+		}
+	}
+	return bits;
+}
+
+/**
+ * Packs the lines which are sent on one side and returns the size
+ * of the message. The sparse encoding is chosen when it is smaller,
+ * that is when less than about 1 - 1 / (8 * cell bytes) of the cells
+ * are occupied.
+ */
+static int packSide(WorldPtr world, Halo * halo, int side) {
+	HaloSide * s = halo->sides + side;
+	bool rows = side == HALO_UP || side == HALO_DOWN;
+	HaloHeader * header = (HaloHeader *) s->sendBuffer;
+	BitWord * bitmap = (BitWord *) (header + 1);
+	int lineWords = (s->length + BITS_IN_WORD - 1) / BITS_IN_WORD;
+	int words = halo->lines * lineWords;
+
+	// the bitmap is written where the dense cells would be
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+	for (int w = 0; w < words; w++) {
+		bitmap[w] = getOccupancy(world, s, rows, w / lineWords,
+				(w % lineWords) * BITS_IN_WORD);
+	}
+	size_t denseBytes = (size_t) halo->lines * s->length * s->cellBytes;
+	// one thread chooses the encoding, the others read it from the header
+#ifdef _OPENMP
+#pragma omp single
+#endif
+	{
+		int occupied = countOccupied(s, bitmap, words);
+		header->occupied = occupied;
+		header->sparse = words * sizeof(BitWord) + occupied * s->cellBytes
+				< denseBytes;
+	}
+
+	if (header->sparse) {
+		copyOccupied(world, halo, side, true, bitmap, header->occupied);
+		return sizeof(HaloHeader) + words * sizeof(BitWord)
+				+ header->occupied * s->cellBytes;
+	} else {
+		copyLines(world, halo, side, true, (char *) (header + 1));
+		return sizeof(HaloHeader) + denseBytes;
+	}
+}
+
+/**
+ * Unpacks the lines which were received on one side in either encoding.
+ */
+static void unpackSide(WorldPtr world, Halo * halo, int side) {
+	HaloSide * s = halo->sides + side;
+	HaloHeader * header = (HaloHeader *) s->receiveBuffer;
+	if (header->sparse) {
+		BitWord * bitmap = (BitWord *) (header + 1);
+		int lineWords = (s->length + BITS_IN_WORD - 1) / BITS_IN_WORD;
+#ifdef _OPENMP
+#pragma omp single
+#endif
+		countOccupied(s, bitmap, halo->lines * lineWords);
+		copyOccupied(world, halo, side, false, bitmap, header->occupied);
+	} else {
+		copyLines(world, halo, side, false, (char *) (header + 1));
+	}
+}
+
+#ifdef SHARED_HALOS
+/**
+ * Where the lines which a process sends on one side are in its memory,
+ * for the process on the same node which copies them itself.
+ * The planes are sent as offsets from the start of the cells,
+ * as the receiver maps the shared memory at another address.
+ */
+typedef struct SharedLines {
+	size_t offsets[CELL_PLANES];
+	char * cells; // the cells of the source as mapped by the receiver
+	unsigned int stride;
+	int sendX;
+	int sendY;
+	int lineStep;
+} SharedLines;
+
+/**
+ * Returns the rank of the process in the communicator of the node,
+ * or MPI_UNDEFINED if it is on another node.
+ */
+static int getNodeRank(WorldPtr world, int rank) {
+	MPI_Group group, nodeGroup;
+	MPI_Comm_group(world->comm, &group);
+	MPI_Comm_group(world->nodeComm, &nodeGroup);
+	int nodeRank;
+	MPI_Group_translate_ranks(group, 1, &rank, nodeGroup, &nodeRank);
+	MPI_Group_free(&group);
+	MPI_Group_free(&nodeGroup);
+	return nodeRank;
+}
+
+/**
+ * Tells the destinations on the same node where the lines of each side are
+ * and learns the same from the sources on the same node.
+ * The other sides keep exchanging messages.
+ */
+static void shareLines(WorldPtr world, Halo * halo) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+
+	SharedLines sent[HALO_SIDES];
+	MPI_Request requests[2 * HALO_SIDES];
+	int sourceRanks[HALO_SIDES];
+	int requestCount = 0;
+	for (int side = 0; side < halo->sideCount; side++) {
+		HaloSide * s = halo->sides + side;
+		s->sharedDestination = getNodeRank(world, s->destination)
+				!= MPI_UNDEFINED;
+		if (s->sharedDestination) {
+			SharedLines * lines = sent + side;
+			for (int p = 0; p < CELL_PLANES; p++) {
+				lines->offsets[p] = (char *) bases[p] - (char *) world->cells;
+			}
+			lines->cells = NULL;
+			lines->stride = world->stride;
+			lines->sendX = s->sendX;
+			lines->sendY = s->sendY;
+			lines->lineStep = s->lineStep;
+			MPI_Isend(lines, sizeof(SharedLines), MPI_BYTE, s->destination,
+					s->tag, world->comm, requests + (requestCount++));
+		}
+
+		sourceRanks[side] = getNodeRank(world, s->source);
+		s->sharedSource = NULL;
+		if (sourceRanks[side] != MPI_UNDEFINED) {
+			s->sharedSource = (SharedLines *) malloc(sizeof(SharedLines));
+			MPI_Irecv(s->sharedSource, sizeof(SharedLines), MPI_BYTE,
+					s->source, s->tag, world->comm,
+					requests + (requestCount++));
+		}
+	}
+	MPI_Waitall(requestCount, requests, MPI_STATUSES_IGNORE);
+
+	for (int side = 0; side < halo->sideCount; side++) {
+		SharedLines * lines = halo->sides[side].sharedSource;
+		if (lines != NULL) {
+			MPI_Aint size;
+			int unit;
+			MPI_Win_shared_query(world->window, sourceRanks[side], &size,
+					&unit, &lines->cells);
+		}
+	}
+}
+
+/**
+ * Copies the lines of one side from the memory of the source
+ * on the same node straight into the received lines.
+ */
+static void copySharedLines(WorldPtr world, Halo * halo, int side) {
+	HaloSide * s = halo->sides + side;
+	SharedLines * source = s->sharedSource;
+	bool rows = side == HALO_UP || side == HALO_DOWN;
+
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+
+	for (int p = 0; p < CELL_PLANES; p++) {
+		size_t size = sizes[p];
+		char * to = (char *) bases[p]
+				+ CELL_INDEX(world, s->receiveX, s->receiveY) * size;
+		const char * from = source->cells + source->offsets[p]
+				+ ((size_t) source->sendX * source->stride + source->sendY)
+						* size;
+		size_t toColumn = world->stride * size;
+		size_t fromColumn = source->stride * size;
+		if (rows) {
+			ptrdiff_t toLine = s->lineStep * (ptrdiff_t) size;
+			ptrdiff_t fromLine = source->lineStep * (ptrdiff_t) size;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+			for (int i = 0; i < s->length; i++) {
+				for (int l = 0; l < halo->lines; l++) {
+					copyCellBytes(to + i * toColumn + l * toLine,
+							from + i * fromColumn + l * fromLine, size);
+				}
+			}
+		} else {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+			for (int l = 0; l < halo->lines; l++) {
+				memcpy(to + l * s->lineStep * (ptrdiff_t) toColumn,
+						from + l * source->lineStep * (ptrdiff_t) fromColumn,
+						s->length * size);
+			}
+		}
+	}
+}
+
+/**
+ * Waits for all the processes on the same node, so the cells written
+ * by any of them before are visible to all of them after.
+ */
+static void syncNode(WorldPtr world) {
+	MPI_Win_sync(world->window);
+	MPI_Barrier(world->nodeComm);
+	MPI_Win_sync(world->window);
+}
+#endif
+
+/**
+ * Creates the persistent sends of one side, from the shortest sparse
+ * message up to the dense one.
+ */
+static void initSends(WorldPtr world, Halo * halo, int side) {
+	HaloSide * s = halo->sides + side;
+	s->sendSizeCount = 0;
+#ifdef SHARED_HALOS
+	if (s->sharedDestination) {
+		return; // its send request stays MPI_REQUEST_NULL
+	}
+#endif
+	// a sparse message holds at least the bitmap
+	int words = halo->lines * ((s->length + BITS_IN_WORD - 1) / BITS_IN_WORD);
+	int size = MIN((int) (sizeof(HaloHeader) + words * sizeof(BitWord)),
+			s->bytes);
+	while (true) {
+		if (s->sendSizeCount == HALO_SEND_SIZES - 1) {
+			size = s->bytes;
+		}
+		s->sendSizes[s->sendSizeCount] = size;
+		MPI_Send_init(s->sendBuffer, size, MPI_BYTE, s->destination, s->tag,
+				world->comm, s->sendRequests + (s->sendSizeCount++));
+		if (size == s->bytes) {
+			break;
+		}
+		size = size > s->bytes / 2 ? s->bytes : 2 * size;
+	}
+}
+
+void initHalo(WorldPtr world, Halo * halo, int sides, int lines, int tag) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+	size_t cellBytes = 0;
+	for (int p = 0; p < CELL_PLANES; p++) {
+		cellBytes += sizes[p];
+	}
+
+	halo->lines = lines;
+	halo->sideCount = sides;
+	halo->sentBytes = 0;
+	for (int side = 0; side < sides; side++) {
+		HaloSide * s = halo->sides + side;
+		bool rows = side == HALO_UP || side == HALO_DOWN;
+		if (side >= HALO_EDGES) {
+			s->length = lines;
+		} else {
+			s->length = rows ? world->localWidth : world->localHeight;
+		}
+		s->cellBytes = cellBytes;
+		// the sparse encoding is used only when it is smaller
+		s->bytes = sizeof(HaloHeader) + lines * s->length * cellBytes;
+		int words = lines * ((s->length + BITS_IN_WORD - 1) / BITS_IN_WORD);
+		s->sendBuffer = (char *) malloc(s->bytes);
+		s->receiveBuffer = (char *) malloc(s->bytes);
+		s->wordOffsets = (int *) malloc(sizeof(int) * words);
+		if (s->sendBuffer == NULL || s->receiveBuffer == NULL
+				|| s->wordOffsets == NULL) {
+			LOG_ERROR("Could not allocate halo buffers of %d bytes\n",
+					s->bytes);
+			exit(1);
+		}
+		s->tag = tag + side;
+	}
+#ifdef SHARED_HALOS
+	shareLines(world, halo);
+#endif
+
+	for (int side = 0; side < sides; side++) {
+		HaloSide * s = halo->sides + side;
+		// the sends are inactive until the first start
+		halo->requests[sides + side] = MPI_REQUEST_NULL;
+		initSends(world, halo, side);
+#ifdef SHARED_HALOS
+		if (s->sharedSource != NULL) {
+			halo->requests[side] = MPI_REQUEST_NULL;
+			continue;
+		}
+#endif
+		MPI_Recv_init(s->receiveBuffer, s->bytes, MPI_BYTE, s->source,
+				s->tag, world->comm, halo->requests + side);
+	}
+}
+
+void startHalo(WorldPtr world, Halo * halo) {
+	// MPI is called only by the master thread (see simulateStep)
+#ifdef _OPENMP
+#pragma omp master
+#endif
+	{
+#ifdef SHARED_HALOS
+		for (int side = 0; side < halo->sideCount; side++) {
+			if (halo->requests[side] != MPI_REQUEST_NULL) {
+				MPI_Start(halo->requests + side);
+			}
+		}
+#else
+		MPI_Startall(halo->sideCount, halo->requests);
+#endif
+	}
+	for (int side = 0; side < halo->sideCount; side++) {
+		HaloSide * s = halo->sides + side;
+#ifdef SHARED_HALOS
+		if (s->sharedDestination) {
+			continue; // its send request stays MPI_REQUEST_NULL
+		}
+#endif
+		// the team packs the side, which ends with a barrier
+		int bytes = packSide(world, halo, side);
+#ifdef _OPENMP
+#pragma omp master
+#endif
+		{
+			// the shortest send which holds the message
+			int size = 0;
+			while (s->sendSizes[size] < bytes) {
+				size++;
+			}
+			MPI_Start(s->sendRequests + size);
+			halo->requests[halo->sideCount + side] = s->sendRequests[size];
+			halo->sentBytes += s->sendSizes[size];
+		}
+	}
+#ifdef SHARED_HALOS
+	// the sources wrote their lines before the first barrier
+	// and they change them only after the second one
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp master
+#endif
+	syncNode(world);
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+	for (int side = 0; side < halo->sideCount; side++) {
+		if (halo->sides[side].sharedSource != NULL) {
+			copySharedLines(world, halo, side);
+		}
+	}
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp master
+#endif
+	syncNode(world);
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+#endif
+}
+
+void finishHalo(WorldPtr world, Halo * halo) {
+#ifdef _OPENMP
+#pragma omp master
+#endif
+	MPI_Waitall(2 * halo->sideCount, halo->requests, MPI_STATUSES_IGNORE);
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+	for (int side = 0; side < halo->sideCount; side++) {
+#ifdef SHARED_HALOS
+		if (halo->sides[side].sharedSource != NULL) {
+			continue; // copied already
+		}
+#endif
+		unpackSide(world, halo, side);
+	}
+}
+
+void destroyHalo(Halo * halo) {
+	// the receives are missing for the sources on the same node
+	// and the sends for the destinations on the same node
+	for (int side = 0; side < halo->sideCount; side++) {
+		if (halo->requests[side] != MPI_REQUEST_NULL) {
+			MPI_Request_free(halo->requests + side);
+		}
+		HaloSide * s = halo->sides + side;
+		for (int size = 0; size < s->sendSizeCount; size++) {
+			MPI_Request_free(s->sendRequests + size);
+		}
+#ifdef SHARED_HALOS
+		free(halo->sides[side].sharedSource);
+#endif
+		free(halo->sides[side].sendBuffer);
+		free(halo->sides[side].receiveBuffer);
+		free(halo->sides[side].wordOffsets);
+	}
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef HALO_H_
+#define HALO_H_
+
+#include "world.h"
+
+#ifdef USE_MPI
+/**
+ * Allocates the buffers of the halo and creates its persistent requests.
+ * The ranks, the first lines and the line steps of the sides
+ * must be set already; tag + side is the tag of each side.
+ * Sides is HALO_EDGES, or HALO_SIDES when the corners are exchanged.
+ * With SHARED_HALOS, it is collective for the processes on the same node,
+ * which learn where the lines of each other are.
+ */
+void initHalo(WorldPtr world, Halo * halo, int sides, int lines, int tag);
+
+/**
+ * Starts the receives, packs the lines of each side and sends them.
+ * With SHARED_HALOS, the lines of the sources on the same node
+ * are copied here, between two barriers of the node.
+ * Like finishHalo, it is called by all the threads of the parallel
+ * region or outside of one; only the master thread calls MPI.
+ */
+void startHalo(WorldPtr world, Halo * halo);
+
+/**
+ * Waits for all the requests and unpacks the received lines.
+ */
+void finishHalo(WorldPtr world, Halo * halo);
+
+/**
+ * Frees the requests and the buffers of the halo.
+ */
+void destroyHalo(Halo * halo);
+#endif
+
+#endif /* HALO_H_ */
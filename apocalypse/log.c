@@ -4,16 +4,12 @@
 #include "world.h"
 
 void initRedirectToFiles(WorldPtr world) {
-	{
-		char filenameOut[255];
-		if (world->globalColumns == 1 && world->globalRows == 1) {
-			sprintf(filenameOut, "output/apocalypse.out");
-		} else {
-			sprintf(filenameOut, "output/apocalypse-%d-%d.out", world->globalX,
-					world->globalY);
-		}
-
-		freopen(filenameOut, "w", stdout);
+	// only the first process prints the stats, those of the whole world,
+	// so the others do not create empty files
+	if (world->globalX == 0 && world->globalY == 0) {
+		freopen("output/apocalypse.out", "w", stdout);
+	} else {
+		freopen("/dev/null", "w", stdout);
 	}
 
 	{
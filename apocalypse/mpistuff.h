@@ -3,32 +3,105 @@
 
 //#define USE_MPI
 
+#if defined(SHARED_HALOS) && !defined(USE_MPI)
+#error "SHARED_HALOS shares the halos of MPI processes, use it with USE_MPI"
+#endif
+
 #ifdef USE_MPI
 
 #include <mpi.h>
 
-// 4 input sides: each side is two sends and two receives
-// 4 output sides: each side is one send and one receive
-// 1 output stats: 1 gather all
-#define MAX_REQUESTS (4*4)
+// the stats reduction, which is finished with the input border
+// the cells are exchanged by the halos, which have their own requests
+#define MAX_REQUESTS 1
 
 #define SHIFT_LEFT_RIGHT 0
 #define SHIFT_UP_DOWN 1
 
-// tags containing numeral 1 are the more distant ones
-#define TOP_INPUT_BORDER_TAG 0
-#define TOP1_INPUT_BORDER_TAG 1
-#define BOTTOM_INPUT_BORDER_TAG 2
-#define BOTTOM1_INPUT_BORDER_TAG 3
-#define LEFT_INPUT_BORDER_TAG 4
-#define LEFT1_INPUT_BORDER_TAG 5
-#define RIGHT_INPUT_BORDER_TAG 6
-#define RIGHT1_INPUT_BORDER_TAG 7
-
-#define TOP_OUTPUT_BORDER_TAG 8
-#define BOTTOM_OUTPUT_BORDER_TAG 9
-#define LEFT_OUTPUT_BORDER_TAG 10
-#define RIGHT_OUTPUT_BORDER_TAG 11
+// the load of a part, used for rebalancing (see rebalanceWorld),
+// is the count of its cells plus this cost of each entity
+#define REBALANCE_ENTITY_COST 50
+// the largest load divided by the mean one which starts the rebalancing
+#define REBALANCE_THRESHOLD 1.1
+// the parts are never thinner than this, so all the halo lines fit
+#define REBALANCE_MIN_SIZE (BORDER_LINES > 8 ? BORDER_LINES : 8)
+
+// the sides of a halo, named by the neighbour to which the lines are sent
+#define HALO_UP 0
+#define HALO_DOWN 1
+#define HALO_LEFT 2
+#define HALO_RIGHT 3
+// the corners, which only the deep border exchanges (see EXCHANGE_EVERY)
+#define HALO_UP_LEFT 4
+#define HALO_UP_RIGHT 5
+#define HALO_DOWN_LEFT 6
+#define HALO_DOWN_RIGHT 7
+#define HALO_EDGES 4
+#define HALO_SIDES 8
+
+// the tag of each side is the tag of the halo plus the side
+#define BORDER_HALO_TAG 0
+#define GHOSTS_HALO_TAG HALO_SIDES
+
+// the most sizes of the persistent sends of one side
+#define HALO_SEND_SIZES 16
+
+/**
+ * Lines of cells exchanged with the neighbours in one direction.
+ * The lines are rows for HALO_UP and HALO_DOWN, columns otherwise.
+ * A corner is a square of as many columns as there are lines.
+ * All the lines and cell planes go in one message, packed in a buffer
+ * either densely or sparsely as only the occupied cells (see halo.c).
+ * With SHARED_HALOS, the lines of a source on the same node are copied
+ * directly from its memory instead.
+ */
+typedef struct HaloSide {
+	int destination; // rank to which the lines are sent
+	int source; // rank on the opposite side from which the lines come
+	int tag;
+	int sendX; // first cell of the first line which is sent
+	int sendY;
+	int receiveX; // first cell of the first line which is received
+	int receiveY;
+	int lineStep; // +1 or -1 from one line to the next one
+	int length; // cells in each line
+	int cellBytes; // bytes of a cell in all the planes
+	int bytes; // the largest size of the message
+	char * sendBuffer;
+	// persistent sends of the buffer, each of them twice as long
+	// as the previous one up to bytes; a message goes by the shortest
+	// one which holds it, the receiver finds its length from the header
+	MPI_Request sendRequests[HALO_SEND_SIZES];
+	int sendSizes[HALO_SEND_SIZES];
+	int sendSizeCount;
+	char * receiveBuffer;
+	int * wordOffsets; // occupied cells before each word of the bitmap
+#ifdef SHARED_HALOS
+	int sharedDestination; // the destination copies the lines itself
+	struct SharedLines * sharedSource; // NULL if not on the same node
+#endif
+} HaloSide;
+
+/**
+ * Starts each message, so the receiver knows how it is encoded.
+ */
+typedef struct HaloHeader {
+	int sparse;
+	int occupied; // count of occupied cells in a sparse message
+} HaloHeader;
+
+/**
+ * The exchange with the four neighbours, or all the eight of them
+ * when the corners are exchanged as well.
+ * The requests are persistent, they are created once with the world.
+ */
+typedef struct Halo {
+	int lines; // lines on each side
+	int sideCount; // HALO_EDGES or HALO_SIDES with the corners
+	HaloSide sides[HALO_SIDES];
+	MPI_Request requests[2 * HALO_SIDES]; // receives then started sends
+	long long sentBytes; // since the halo was created
+} Halo;
 
 #endif
 
@@ -27,20 +27,27 @@ void printWorld(WorldPtr world, bool borders) {
 
 	for (int y = 0; y < world->localHeight + (borders ? 4 : 0); y++) {
 		for (int x = 0; x < world->localWidth + (borders ? 4 : 0); x++) {
-			CellPtr ptr = GET_CELL_PTR(world, x + (borders ? 0 : world->xStart),
+			CellIndex index = CELL_INDEX(world,
+					x + (borders ? 0 : world->xStart),
 					y + (borders ? 0 : world->yStart));
-			int age = world->clock - ptr->origin;
-			switch (ptr->type) {
+			EntityType type = GET_TYPE(world, index);
+			if (type == NONE) {
+				continue;
+			}
+			int age = world->clock - GET_ORIGIN(world, index);
+			int genderIndex = GET_GENDER(world, index)
+					+ GET_CHILDREN(world, index);
+			switch (type) {
 			case NONE:
 				// nothing
 				break;
 			case HUMAN:
-				fprintf(out, "[%d %d] H %c %d\n", x, y,
-						gender[ptr->gender + ptr->children], age);
+				fprintf(out, "[%d %d] H %c %d\n", x, y, gender[genderIndex],
+						age);
 				break;
 			case INFECTED:
-				fprintf(out, "[%d %d] I %c %d\n", x, y,
-						gender[ptr->gender + ptr->children], age);
+				fprintf(out, "[%d %d] I %c %d\n", x, y, gender[genderIndex],
+						age);
 				break;
 			case ZOMBIE:
 				fprintf(out, "[%d %d] Z _ %d\n", x, y, age);
@@ -54,26 +61,28 @@ void printWorld(WorldPtr world, bool borders) {
 void printPopulations(Stats stats) {
 	// make sure there are always blanks around numbers
 	// that way we can easily split the line
-	printf("Time: %6lld \tHumans: %6d \tInfected: %6d \tZombies: %6d\n",
-			stats.clock, stats.humanFemales + stats.humanMales,
+	printf("Time: %6lld \tHumans: %6lld \tInfected: %6lld "
+			"\tZombies: %6lld\n", stats.clock,
+			stats.humanFemales + stats.humanMales,
 			stats.infectedFemales + stats.infectedMales, stats.zombies);
 
 #ifndef NDETAILED_STATS
-	printf("LHF: %6d \tLHM: %6d \tLIF: %6d \tLIM: %6d \tLZ:  %6d\n",
+	printf("LHF: %6lld \tLHM: %6lld \tLIF: %6lld \tLIM: %6lld \tLZ:  %6lld\n",
 			stats.humanFemales, stats.humanMales, stats.infectedFemales,
 			stats.infectedMales, stats.zombies);
-	printf("DHF: %6d \tDHM: %6d \tDIF: %6d \tDIM: %6d \tDZ:  %6d\n",
+	printf("DHF: %6lld \tDHM: %6lld \tDIF: %6lld \tDIM: %6lld \tDZ:  %6lld\n",
 			stats.humanFemalesDied, stats.humanMalesDied,
 			stats.infectedFemalesDied, stats.infectedMalesDied,
 			stats.zombiesDecomposed);
-	printf("BHF: %6d \tBHM: %6d \tBIF: %6d \tBIM: %6d\n",
+	printf("BHF: %6lld \tBHM: %6lld \tBIF: %6lld \tBIM: %6lld\n",
 			stats.humanFemalesBorn, stats.humanMalesBorn,
 			stats.infectedFemalesBorn, stats.infectedMalesBorn);
-	printf("PH:  %6d \tPI:  %6d \tGBH: %6d \tGBI: %6d \tCML: %6d \tCC:  %6d\n",
-			stats.humanFemalesPregnant, stats.infectedFemalesPregnant,
+	printf("PH:  %6lld \tPI:  %6lld \tGBH: %6lld \tGBI: %6lld \tCML: %6lld "
+			"\tCC:  %6lld\n", stats.humanFemalesPregnant,
+			stats.infectedFemalesPregnant,
 			stats.humanFemalesBecameInfected, stats.infectedFemalesGivingBirth,
 			stats.couplesMakingLove, stats.childrenConceived);
-	printf("IHF: %6d \tIHM: %6d \tIFZ: %6d \tIMZ: %6d\n",
+	printf("IHF: %6lld \tIHM: %6lld \tIFZ: %6lld \tIMZ: %6lld\n",
 			stats.humanFemalesBecameInfected, stats.humanMalesBecameInfected,
 			stats.infectedFemalesBecameZombies,
 			stats.infectedMalesBecameZombies);
@@ -87,6 +96,81 @@ void printStatistics(WorldPtr world, Stats cumulative) {
 	}
 #endif
 
+#if ! defined(NPOPULATION) && ! defined(USE_MPI)
+	if (world->clock % POPULATION_EVERY == 0) {
+#ifndef NCUMULATIVE_STATS
+		printPopulations(cumulative);
+#else
+		printPopulations(world->stats);
+#endif
+	}
+#endif
+}
+
+#ifdef USE_MPI
+void printGlobalStatistics(WorldPtr world, Stats cumulative) {
+#ifndef NPOPULATION
+	if (world->globalX == 0 && world->globalY == 0
+			&& world->globalStats.clock % POPULATION_EVERY == 0) {
+#ifndef NCUMULATIVE_STATS
+		printPopulations(cumulative);
+#else
+		printPopulations(world->globalStats);
+#endif
+	}
+#endif
+}
+#endif
+
+#ifdef AGENT_ENGINE
+void printAgentWorld(AgentWorldPtr world) {
+	char gender[5] = { 'M', 'F', 'f', 'f', 'f' };
+
+	char filename[255];
+	sprintf(filename, "images/step-%06lld.img", world->clock);
+
+	FILE * out = fopen(filename, "w");
+	if (out == NULL) {
+		LOG_ERROR("Could not open file %s for writing\n", filename);
+		return;
+	}
+
+	fprintf(out, "Width %d; Height %d; Time %lld\n", world->width,
+			world->height, world->clock);
+
+	// the agents are not sorted by their position
+	for (int i = 0; i < world->agentCount; i++) {
+		AgentPtr agent = world->agents + i;
+		EntityPtr entity = &agent->entity;
+		int age = world->clock - entity->origin;
+		int genderIndex = entity->gender + entity->children;
+		switch (entity->type) {
+		case NONE:
+			// nothing
+			break;
+		case HUMAN:
+			fprintf(out, "[%d %d] H %c %d\n", agent->x, agent->y,
+					gender[genderIndex], age);
+			break;
+		case INFECTED:
+			fprintf(out, "[%d %d] I %c %d\n", agent->x, agent->y,
+					gender[genderIndex], age);
+			break;
+		case ZOMBIE:
+			fprintf(out, "[%d %d] Z _ %d\n", agent->x, agent->y, age);
+		}
+	}
+
+	fclose(out);
+}
+
+void printAgentStatistics(AgentWorldPtr world, Stats cumulative) {
+#ifndef NIMAGES
+	if (world->clock % IMAGES_EVERY == 0) {
+		printAgentWorld(world);
+	}
+#endif
+
 #ifndef NPOPULATION
 	if (world->clock % POPULATION_EVERY == 0) {
 #ifndef NCUMULATIVE_STATS
@@ -97,3 +181,4 @@ void printStatistics(WorldPtr world, Stats cumulative) {
 	}
 #endif
 }
+#endif
@@ -10,6 +10,9 @@
 
 #include "world.h"
 #include "stats.h"
+#ifdef AGENT_ENGINE
+#include "agents.h"
+#endif
 
 #ifndef OUTPUT_EVERY
 #define OUTPUT_EVERY 1
@@ -42,6 +45,31 @@ void printWorld(WorldPtr world, bool borders);
  */
 void printPopulations(Stats stats);
 
+/**
+ * Prints the image of the world and its populations when it is time.
+ * With MPI, the populations are printed by printGlobalStatistics.
+ */
 void printStatistics(WorldPtr world, Stats cumulative);
 
+#ifdef USE_MPI
+/**
+ * Prints the populations of the whole world, which were reduced
+ * into globalStats. Only the first process prints them,
+ * so there is one series for all the processes.
+ */
+void printGlobalStatistics(WorldPtr world, Stats cumulative);
+#endif
+
+#ifdef AGENT_ENGINE
+/**
+ * The same as printWorld for the agent engine.
+ */
+void printAgentWorld(AgentWorldPtr world);
+
+/**
+ * The same as printStatistics for the agent engine.
+ */
+void printAgentStatistics(AgentWorldPtr world, Stats cumulative);
+#endif
+
 #endif /* OUTPUT_H_ */
@@ -1,58 +1,253 @@
 #include <stdlib.h>
 #include <math.h>
-#include <omp.h>
 
 // for seeding
 #include <time.h>
 #include <unistd.h>
 
 #include "random.h"
+#include "mpistuff.h"
+#include "common.h"
 
-typedef unsigned short PRNGState[3];
+/**
+ * Philox4x32-10 (Salmon et al., Parallel Random Numbers: As Easy as 1, 2, 3).
+ * It maps a counter and a key to four random words; there is no other state.
+ */
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
 
-static PRNGState *states;
+#define WORDS_IN_BLOCK 4
+
+// the bulk samplers generate the words into a buffer of this size
+#define WORDS_IN_CHUNK 64
+
+/**
+ * The stream of one thread: the key and the counter of the next block
+ * and the words of the current block which were not used yet.
+ */
+typedef struct RandomStream {
+	unsigned int key[2];
+	unsigned int counter[WORDS_IN_BLOCK];
+	unsigned int block[WORDS_IN_BLOCK];
+	int position; // next unused word of the block
+	double spareNormal; // second variate of the last pair
+	int hasSpareNormal;
+} RandomStream;
+
+static unsigned int randomSeed;
+
+static __thread RandomStream stream;
+
+static inline void philox(const unsigned int key[2],
+		const unsigned int counter[WORDS_IN_BLOCK],
+		unsigned int output[WORDS_IN_BLOCK]) {
+	unsigned int c0 = counter[0], c1 = counter[1];
+	unsigned int c2 = counter[2], c3 = counter[3];
+	unsigned int k0 = key[0], k1 = key[1];
+	for (int round = 0; round < PHILOX_ROUNDS; round++) {
+		unsigned long long p0 = (unsigned long long) PHILOX_M0 * c0;
+		unsigned long long p1 = (unsigned long long) PHILOX_M1 * c2;
+		c0 = (unsigned int) (p1 >> 32) ^ c1 ^ k0;
+		c1 = (unsigned int) p1;
+		c2 = (unsigned int) (p0 >> 32) ^ c3 ^ k1;
+		c3 = (unsigned int) p0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	output[0] = c0;
+	output[1] = c1;
+	output[2] = c2;
+	output[3] = c3;
+}
 
 void initRandom(unsigned int seed) {
 	if (seed == 0) {
 		seed = (time(NULL) & 0xFFFF) | (getpid() << 16);
 	}
-	srand48(seed);
-
-#ifdef _OPENMP
-	int threads = omp_get_max_threads();
-#else
-	int threads = 1;
+#ifdef USE_MPI
+	// all the processes must use the same seed,
+	// the benchmarks of one process do not initialize MPI
+	int initialized;
+	MPI_Initialized(&initialized);
+	if (initialized) {
+		MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+	}
 #endif
+	randomSeed = seed;
+	setRandomStream(0, 0, 0, RANDOM_STREAM_MAIN);
+}
 
-	states = malloc(sizeof(PRNGState) * threads);
-	for (int i = 0; i < threads; i++) {
-		states[i][0] = (unsigned short) (0xFFFF * drand48());
-		states[i][1] = (unsigned short) (0xFFFF * drand48());
-		states[i][2] = (unsigned short) (0xFFFF * drand48());
-	}
+unsigned int getRandomSeed() {
+	return randomSeed;
 }
 
 void destroyRandom() {
-	free(states);
+	// there is nothing to free
 }
 
-simClock randomEvent(simClock mean, simClock stdDev) {
+void setRandomStream(simClock clock, int x, int y, unsigned int purpose) {
+	stream.key[0] = randomSeed;
+	stream.key[1] = purpose;
+	stream.counter[0] = (unsigned int) clock;
+	stream.counter[1] = (unsigned int) x;
+	stream.counter[2] = (unsigned int) y;
+	stream.counter[3] = 0;
+	stream.position = WORDS_IN_BLOCK;
+	stream.hasSpareNormal = 0;
+}
+
+unsigned int randomWord() {
+	if (stream.position == WORDS_IN_BLOCK) {
+		philox(stream.key, stream.counter, stream.block);
+		stream.counter[3]++;
+		stream.position = 0;
+	}
+	return stream.block[stream.position++];
+}
+
+void randomWords(unsigned int * words, int count) {
+	int i = 0;
+	// finish the current block
+	while (i < count && stream.position < WORDS_IN_BLOCK) {
+		words[i++] = stream.block[stream.position++];
+	}
+	// whole blocks are independent, so this loop can be vectorised
+	unsigned int blocks = (count - i) / WORDS_IN_BLOCK;
+	unsigned int first = stream.counter[3];
+	for (unsigned int b = 0; b < blocks; b++) {
+		unsigned int counter[WORDS_IN_BLOCK] = { stream.counter[0],
+				stream.counter[1], stream.counter[2], first + b };
+		philox(stream.key, counter, words + i + b * WORDS_IN_BLOCK);
+	}
+	stream.counter[3] = first + blocks;
+	i += blocks * WORDS_IN_BLOCK;
+	// and the rest
+	while (i < count) {
+		words[i++] = randomWord();
+	}
+}
+
+void skipRandomWords(unsigned int count) {
+	unsigned int left = WORDS_IN_BLOCK - stream.position;
+	if (count <= left) {
+		stream.position += count;
+		return;
+	}
+	// the blocks are independent, so whole ones are skipped by the counter
+	count -= left;
+	stream.counter[3] += count / WORDS_IN_BLOCK;
+	stream.position = WORDS_IN_BLOCK;
+	for (unsigned int i = 0; i < count % WORDS_IN_BLOCK; i++) {
+		randomWord();
+	}
+}
+
+/**
+ * Makes a double in [0, 1) with 53 random bits of two words.
+ */
+static inline double wordsToDouble(unsigned int high, unsigned int low) {
+	unsigned long long bits = ((unsigned long long) high << 32 | low) >> 11;
+	return bits * (1.0 / (1ULL << 53));
+}
+
+void randomDoubles(double * values, int count) {
+	// each double takes two words
+	unsigned int words[WORDS_IN_CHUNK];
+	for (int start = 0; start < count; start += WORDS_IN_CHUNK / 2) {
+		int chunk = MIN(WORDS_IN_CHUNK / 2, count - start);
+		randomWords(words, 2 * chunk);
+		for (int i = 0; i < chunk; i++) {
+			values[start + i] = wordsToDouble(words[2 * i], words[2 * i + 1]);
+		}
+	}
+}
+
+double randomNormal() {
+	if (stream.hasSpareNormal) {
+		stream.hasSpareNormal = 0;
+		return stream.spareNormal;
+	}
+	// Marsaglia's polar method: a point in the unit circle gives
+	// two independent variates without sin and cos
+	double u, v, s;
+	do {
+		u = 2 * randomDouble() - 1;
+		v = 2 * randomDouble() - 1;
+		s = u * u + v * v;
+	} while (s >= 1 || s == 0);
+	double factor = sqrt(-2 * log(s) / s);
+	stream.spareNormal = v * factor;
+	stream.hasSpareNormal = 1;
+	return u * factor;
+}
+
+void randomNormals(double * values, int count) {
+	int i = 0;
+	if (count > 0 && stream.hasSpareNormal) {
+		stream.hasSpareNormal = 0;
+		values[i++] = stream.spareNormal;
+	}
+	// each attempt takes four words; there are never more attempts
+	// than missing pairs, so the words are those randomNormal would draw
+	unsigned int words[WORDS_IN_CHUNK];
+	double u[WORDS_IN_CHUNK / 4];
+	double v[WORDS_IN_CHUNK / 4];
+	double s[WORDS_IN_CHUNK / 4];
+	while (i < count) {
+		int attempts = MIN(WORDS_IN_CHUNK / 4, (count - i + 1) / 2);
+		randomWords(words, 4 * attempts);
+		// the points of all the attempts first, this loop can be vectorised
+		for (int a = 0; a < attempts; a++) {
+			u[a] = 2 * wordsToDouble(words[4 * a], words[4 * a + 1]) - 1;
+			v[a] = 2 * wordsToDouble(words[4 * a + 2], words[4 * a + 3]) - 1;
+			s[a] = u[a] * u[a] + v[a] * v[a];
+		}
+		for (int a = 0; a < attempts; a++) {
+			if (s[a] >= 1 || s[a] == 0) {
+				continue;
+			}
+			double factor = sqrt(-2 * log(s[a]) / s[a]);
+			values[i++] = u[a] * factor;
+			if (i < count) {
+				values[i++] = v[a] * factor;
+			} else {
+				stream.spareNormal = v[a] * factor;
+				stream.hasSpareNormal = 1;
+			}
+		}
+	}
+}
+
+double randomNormalDirect() {
 	double u1 = randomDouble(); //these are uniform(0,1) random doubles
 	double u2 = randomDouble();
-	double randStdNormal = sqrt(-2.0 * log(u1)) * sin(2.0 * M_PI * u2); //random normal(0,1)
-	double randNormal = mean + stdDev * randStdNormal; //random normal(mean,stdDev^2)
-	return randNormal;
+	return sqrt(-2.0 * log(u1)) * sin(2.0 * M_PI * u2); //random normal(0,1)
+}
+
+simClock randomEvent(simClock mean, simClock stdDev) {
+	return mean + stdDev * randomNormal(); //random normal(mean,stdDev^2)
 }
 
 int randomInt(int min, int max) {
-	return ((int) (randomDouble() * (1 << 24))) % (max - min + 1) + min;
+	// Lemire's multiply-shift with rejection of the biased low part
+	unsigned int range = (unsigned int) (max - min) + 1;
+	unsigned long long product = (unsigned long long) randomWord() * range;
+	unsigned int low = (unsigned int) product;
+	if (low < range) {
+		unsigned int threshold = -range % range;
+		while (low < threshold) {
+			product = (unsigned long long) randomWord() * range;
+			low = (unsigned int) product;
+		}
+	}
+	return min + (int) (product >> 32);
 }
 
 double randomDouble() {
-#ifdef _OPENMP
-	int thread = omp_get_thread_num();
-#else
-	int thread = 0;
-#endif
-	return erand48(states[thread]);
+	unsigned int high = randomWord();
+	unsigned int low = randomWord();
+	return wordsToDouble(high, low);
 }
@@ -10,25 +10,80 @@
 
 #include "clock.h"
 
+/**
+ * The generator is counter based: every random number is a function
+ * of the seed, the stream and the position in the stream.
+ * The streams are keyed by the step, the global position of a cell
+ * and the purpose, so the results do not depend on which thread
+ * processes the cell. With MPI, they do not depend on the parts
+ * of the world only if the border is exchanged every EXCHANGE_EVERY
+ * (two or more) steps: the default step drops the entities which move
+ * into the same cell from both sides of a border, so it depends
+ * on the parts.
+ */
+
+/**
+ * Purposes of the streams, see setRandomStream.
+ */
+#define RANDOM_STREAM_MAIN 0 // initialization
+#define RANDOM_STREAM_WORLD 1 // decisions which concern the whole world
+#define RANDOM_STREAM_STEP1 2 // entity in simulateStep1
+#define RANDOM_STREAM_STEP2 3 // entity in simulateStep2
+#define RANDOM_STREAM_PLACEMENT 4 // cells of the initial population, by columns
+#define RANDOM_STREAM_INITIAL 5 // entity of the initial population
+
 /**
  * Initializes the random generator.
  * This function must be called once when the program starts.
  * If seed is zero, the current time is used instead.
+ * With MPI, the seed of the first process is used by all the processes.
  */
 void initRandom(unsigned int seed);
 
+/**
+ * Returns the seed which is used.
+ */
+unsigned int getRandomSeed();
+
 /**
  * Destroys random generators.
  */
 void destroyRandom();
 
+/**
+ * Switches the stream of the calling thread.
+ * x and y are global coordinates of a cell (or anything unique).
+ * Each thread must set its stream before it draws numbers.
+ */
+void setRandomStream(simClock clock, int x, int y, unsigned int purpose);
+
 /**
  * Gaussian distribution with mean and standard deviation.
  */
 simClock randomEvent(simClock mean, simClock stdDev);
 
+/**
+ * Returns a standard normal variate.
+ * The variates are generated in pairs, the second one is kept
+ * for the next call until the stream is switched.
+ */
+double randomNormal();
+
+/**
+ * Fills the array with standard normal variates.
+ * The same numbers would be returned by the repeated calls of randomNormal.
+ */
+void randomNormals(double * values, int count);
+
+/**
+ * The Box-Muller transform which uses one variate of the pair.
+ * It is kept as the reference for the benchmark, use randomNormal.
+ */
+double randomNormalDirect();
+
 /**
  * Returns a random integer in range with both bounds included.
+ * All values are equally likely.
  */
 int randomInt(int min, int max);
 
@@ -37,4 +92,42 @@ int randomInt(int min, int max);
  */
 double randomDouble();
 
+/**
+ * A probability scaled to the range of randomWord.
+ * Probability 1 is 2^32, so it does not fit into unsigned int.
+ */
+typedef unsigned long long RandomThreshold;
+
+#define RANDOM_THRESHOLD(probability) \
+	((RandomThreshold) ((probability) * 4294967296.0))
+
+/**
+ * Returns true with the probability given by the threshold.
+ * It uses one random word instead of the two of randomDouble.
+ */
+#define RANDOM_CHANCE(threshold) (randomWord() < (threshold))
+
+/**
+ * Returns 32 random bits.
+ */
+unsigned int randomWord();
+
+/**
+ * Fills the array with random words from the current stream.
+ * The same numbers would be returned by the repeated calls of randomWord.
+ */
+void randomWords(unsigned int * words, int count);
+
+/**
+ * Skips the words of the current stream, as if randomWord was called
+ * count times, but computes only the block in which the next word is.
+ */
+void skipRandomWords(unsigned int count);
+
+/**
+ * Fills the array with random doubles in range [0, 1).
+ * The same numbers would be returned by the repeated calls of randomDouble.
+ */
+void randomDoubles(double * values, int count);
+
 #endif /* RANDOM_H_ */
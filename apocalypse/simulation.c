@@ -13,103 +13,251 @@
 #include "mpistuff.h"
 #include "communication.h"
 #include "stats.h"
+#include "bearing.h"
 
-static int countNeighbouringZombies(WorldPtr world, int row, int column);
-static EntityPtr findAdjacentFertileMale(WorldPtr world, int x, int y,
+static int countNeighbouringZombies(WorldPtr world, CellIndex index);
+static CellIndex findAdjacentFertileMale(WorldPtr world, CellIndex index,
 		simClock clock);
-static bearing getBearing(WorldPtr world, int x, int y);
 
 /**
  * These macros require the worlds to be named input and output.
  * CAN_MOVE tests if the cell is empty in both worlds
  */
-#define CAN_MOVE_TO(x, y, dir) \
-	(GET_CELL_DIR((input), (dir), (x), (y)).type == NONE \
-	&& GET_CELL_DIR((output), (dir), (x), (y)).type == NONE)
+#define CAN_MOVE_TO(index, dir) \
+	(!TEST_BIT((input)->occupiedBits, CELL_INDEX_DIR((input), (dir), (index))) \
+	&& !TEST_BIT((output)->occupiedBits, CELL_INDEX_DIR((output), (dir), (index))))
 
 /**
  * IF_CAN_MOVE tests if the cell is empty in both worlds
- * and if it is, it returns the cell, otherwise it returns NULL
+ * and if it is, it returns the cell, otherwise it returns NO_CELL
  */
-#define IF_CAN_MOVE_TO(x, y, dir) \
-	(CAN_MOVE_TO((x), (y), (dir)) ? GET_CELL_PTR_DIR((output), (dir), (x), (y)) : NULL)
+#define IF_CAN_MOVE_TO(index, dir) \
+	(CAN_MOVE_TO((index), (dir)) ? CELL_INDEX_DIR((output), (dir), (index)) : NO_CELL)
 
 /**
- * Order of actions:
- * a) death of human or infected
- * b) decomposition of zombie
- * c) transition of infected to zombie
+ * Removes the living entity which died.
  */
-static void simulateStep1(WorldPtr input, WorldPtr output) {
-	simClock clock = output->clock;
-// we want to force static scheduling because we suppose that the load
-// is distributed evenly over the map and we need to have predictable locking
-#ifdef _OPENMP
-	// at least three columns per thread
-	int threads = omp_get_max_threads();
-	int numThreads = MIN(MAX(input->localWidth / 3, 1), threads);
-#pragma omp parallel for num_threads(numThreads) schedule(static)
-#endif
-	for (int x = input->xStart; x < input->xEnd; x++) {
-		Stats stats = NO_STATS;
-		for (int y = input->yStart; y <= input->yEnd; y++) {
-			EntityPtr entity = GET_CELL_PTR(input, x, y);
-			if (entity->type == NONE) {
-				continue;
-			}
+static void killEntity(EntityPtr entity, Stats * stats) {
+	if (entity->type == HUMAN) {
+		if (entity->gender == FEMALE) {
+			stats->humanFemalesDied++;
+		} else {
+			stats->humanMalesDied++;
+		}
+	} else {
+		if (entity->gender == FEMALE) {
+			stats->infectedFemalesDied++;
+		} else {
+			stats->infectedMalesDied++;
+		}
+	}
+	LOG_EVENT("A %s died\n", entity->type == HUMAN ? "Human" : "Infected");
+	// just forget this entity
+	entity->type = NONE;
+}
 
-			// Death of living entity
-			if (entity->type == HUMAN || entity->type == INFECTED) {
-				if (randomDouble() < getDeathRate(entity, clock)) {
-					if (entity->type == HUMAN) {
-						if (entity->gender == FEMALE) {
-							stats.humanFemalesDied++;
-						} else {
-							stats.humanMalesDied++;
-						}
-					} else {
-						if (entity->gender == FEMALE) {
-							stats.infectedFemalesDied++;
-						} else {
-							stats.infectedMalesDied++;
-						}
-					}
-					LOG_EVENT("A %s died\n",
-							entity->type == HUMAN ? "Human" : "Infected");
-					// just forget this entity
-					entity->type = NONE;
-				}
-			}
+/**
+ * Removes the zombie which decomposed.
+ */
+static void decomposeEntity(EntityPtr entity, Stats * stats) {
+	stats->zombiesDecomposed++;
+	LOG_EVENT("A Zombie decomposed\n");
+	// just forgot this entity
+	entity->type = NONE;
+}
 
-			// Decompose Zombie
-			if (entity->type == ZOMBIE) {
-				if (randomDouble() < getDecompositionRate(entity, clock)) {
-					stats.zombiesDecomposed++;
-					LOG_EVENT("A Zombie decomposed\n");
-					// just forgot this entity
-					entity->type = NONE;
-				}
-			}
+/**
+ * Converts the infected into zombie.
+ */
+static void zombifyEntity(EntityPtr entity, simClock clock, Stats * stats) {
+	if (entity->gender == FEMALE) {
+		stats->infectedFemalesBecameZombies++;
+	} else {
+		stats->infectedMalesBecameZombies++;
+	}
+	toZombie(entity, clock);
+	LOG_EVENT("An Infected became Zombie\n");
+}
 
-			// Convert Infected to Zombie
-			if (entity->type == INFECTED) {
-				if (randomDouble() < PROBABILITY_BECOME_ZOMBIE) {
-					if (entity->gender == FEMALE) {
-						stats.infectedFemalesBecameZombies++;
-					} else {
-						stats.infectedMalesBecameZombies++;
-					}
-					toZombie(entity, clock);
-					LOG_EVENT("An Infected became Zombie\n");
-				}
+#ifdef EVENT_LIFECYCLE
+void simulateEntity1(EntityPtr entity, simClock clock, Stats * stats) {
+	// the event was sampled by scheduleLifecycle, only compare clocks
+	while (entity->type != NONE && entity->event == LIFECYCLE_CLOCK(clock)) {
+		if (!entity->eventDue) {
+			// the hazard changes now, sample again from this step
+			scheduleLifecycle(entity, clock - 1);
+			continue;
+		}
+		switch (entity->type) {
+		case HUMAN:
+			killEntity(entity, stats);
+			break;
+		case INFECTED: {
+			// the event is one of two competing ones
+			double death = getDeathRate(entity, clock);
+			double either = death + PROBABILITY_BECOME_ZOMBIE
+					- death * PROBABILITY_BECOME_ZOMBIE;
+			if (randomDouble() * either < death) {
+				killEntity(entity, stats);
+			} else {
+				zombifyEntity(entity, clock, stats);
 			}
+			break;
 		}
-#ifdef _OPENMP
-#pragma omp critical (StatsCriticalRegion2)
+		case ZOMBIE:
+			decomposeEntity(entity, stats);
+			break;
+		default: // won't happen, silent GCC
+			break;
+		}
+	}
+}
+#else
+void simulateEntity1(EntityPtr entity, simClock clock, Stats * stats) {
+	// Death of living entity
+	if (entity->type == HUMAN || entity->type == INFECTED) {
+		if (RANDOM_CHANCE(getDeathThreshold(entity, clock))) {
+			killEntity(entity, stats);
+		}
+	}
+
+	// Decompose Zombie
+	if (entity->type == ZOMBIE) {
+		if (RANDOM_CHANCE(getDecompositionThreshold(entity, clock))) {
+			decomposeEntity(entity, stats);
+		}
+	}
+
+	// Convert Infected to Zombie
+	if (entity->type == INFECTED) {
+		if (RANDOM_CHANCE(RANDOM_THRESHOLD(PROBABILITY_BECOME_ZOMBIE))) {
+			zombifyEntity(entity, clock, stats);
+		}
+	}
+}
 #endif
-		{
-			mergeStats(&output->stats, stats, true);
+
+void infectEntity(EntityPtr entity, int zombieCount, simClock clock,
+		Stats * stats) {
+	if (entity->type != HUMAN) {
+		return;
+	}
+	double infectionChance = zombieCount * PROBABILITY_INFECTION;
+
+	if (randomDouble() <= infectionChance) {
+		if (entity->gender == FEMALE) {
+			stats->humanFemalesBecameInfected++;
+		} else {
+			stats->humanMalesBecameInfected++;
+		}
+		toInfected(entity, clock);
+		LOG_EVENT("A Human became infected\n");
+	}
+}
+
+void countChild(EntityPtr child, Stats * stats) {
+	if (child->type == HUMAN) {
+		if (child->gender == FEMALE) {
+			stats->humanFemalesBorn++;
+		} else {
+			stats->humanMalesBorn++;
+		}
+	} else {
+		if (child->gender == FEMALE) {
+			stats->infectedFemalesBorn++;
+		} else {
+			stats->infectedMalesBorn++;
+		}
+	}
+	LOG_EVENT("A %s child was born\n",
+			child->type == HUMAN ? "Human" : "Infected");
+}
+
+void countEntity(EntityPtr entity, Stats * stats) {
+	if (entity->type == HUMAN) {
+		if (entity->gender == FEMALE) {
+			stats->humanFemales++;
+		} else {
+			stats->humanMales++;
+		}
+	} else if (entity->type == INFECTED) {
+		if (entity->gender == FEMALE) {
+			stats->infectedFemales++;
+		} else {
+			stats->infectedMales++;
+		}
+	} else {
+		stats->zombies++;
+	}
+}
+
+Direction chooseDirection(EntityPtr entity, bearing bearing_, simClock clock) {
+	bearing_ += getRandomBearing() * BEARING_FLUCTUATION;
+
+	Direction dir = bearingToDirection(bearing_);
+	if (dir != STAY) {
+		double bearingRandomQuotient = (randomDouble() - 0.5)
+				* BEARING_ABS_QUOTIENT_VARIANCE
+				+ BEARING_ABS_QUOTIENT_MEAN;
+		entity->bearing = bearing_ / cabsf(bearing_)
+				* bearingRandomQuotient;
+	} else {
+		entity->bearing = bearing_;
+	}
+
+	// some randomness in direction
+	// the entity will never go in the opposite direction
+	if (dir != STAY) {
+		if (RANDOM_CHANCE(getSpeedThreshold(entity, clock))) {
+			double dirRnd = randomDouble();
+			if (dirRnd < DIRECTION_MISSED) {
+				dir = DIRECTION_CCW(dir); // turn counter-clock-wise
+			} else if (dirRnd < DIRECTION_MISSED * 2) {
+				dir = DIRECTION_CW(dir); // turn clock-wise
+			} else if (dirRnd
+					> DIRECTION_FOLLOW + DIRECTION_MISSED * 2) {
+				dir = STAY;
+			}
+		} else {
+			dir = STAY;
 		}
+	} else {
+		// if the entity would STAY, we'll try again to make it move
+		// to make the entity bearing variable in terms of absolute value
+		double bearingRandomQuotient = (randomDouble() - 0.5)
+				* BEARING_ABS_QUOTIENT_VARIANCE
+				+ BEARING_ABS_QUOTIENT_MEAN;
+
+		bearing_ += getRandomBearing() * bearingRandomQuotient;
+		dir = bearingToDirection(bearing_);
+	}
+	return dir;
+}
+
+/**
+ * Applies simulateEntity1 to the entity at the index.
+ */
+static void simulateCell1(WorldPtr input, CellIndex index, simClock clock,
+		Stats * stats) {
+	Entity entity;
+	readCell(input, index, &entity);
+	EntityType type = entity.type;
+
+#ifdef EVENT_LIFECYCLE
+	simClockDelta event = entity.event;
+#endif
+
+	simulateEntity1(&entity, clock, stats);
+
+	if (entity.type == NONE) {
+		clearCell(input, index);
+	} else if (entity.type != type) {
+		writeCell(input, index, &entity);
+#ifdef EVENT_LIFECYCLE
+	} else if (entity.event != event) {
+		// rescheduled
+		writeCell(input, index, &entity);
+#endif
 	}
 }
 
@@ -120,311 +268,612 @@ static void simulateStep1(WorldPtr input, WorldPtr output) {
  * c) making love - changes input
  * d) movement
  */
-static void simulateStep2(WorldPtr input, WorldPtr output) {
-	simClock clock = output->clock;
-	// notice that we iterate over xx and yy
-	// and the real x and y are randomly switched between two directions
-	double xxDir = randomDouble();
-	double yyDir = randomDouble();
-
-	// we want to force static scheduling because we suppose that the load
-	// is distributed evenly over the map and we need to have predictable locking
-#ifdef _OPENMP
-	// at least three columns per thread
-	int threads = omp_get_max_threads();
-	int numThreads = MIN(MAX(input->localWidth / 3, 1), threads);
-#pragma omp parallel for num_threads(numThreads) schedule(static)
-#endif
-	for (int xx = input->xStart; xx <= input->xEnd; xx++) {
-		int x = (xxDir < 0.5) ? xx : (input->xEnd + input->xStart - xx);
-		// stats are counted per column and summed at the end
-		Stats stats = NO_STATS;
-		lockColumn(output, x);
-		for (int yy = input->yStart; yy <= input->yEnd; yy++) {
-			int y = (yyDir < 0.5) ? yy : (input->yEnd + input->yStart - yy);
-			Entity entity = GET_CELL(input, x, y);
-			if (entity.type == NONE) {
-				continue;
-			}
+static void simulateCell2(WorldPtr input, WorldPtr output, CellIndex index,
+		simClock clock, Stats * stats) {
+	Entity entity;
+	readCell(input, index, &entity);
+
+	// Convert Human to Infected
+	if (entity.type == HUMAN) {
+		infectEntity(&entity, countNeighbouringZombies(input, index), clock,
+				stats);
+	}
 
-			// Convert Human to Infected
-			if (entity.type == HUMAN) {
-				int zombieCount = countNeighbouringZombies(input, x, y);
-				double infectionChance = zombieCount * PROBABILITY_INFECTION;
-
-				if (randomDouble() <= infectionChance) {
-					if (entity.gender == FEMALE) {
-						stats.humanFemalesBecameInfected++;
-					} else {
-						stats.humanMalesBecameInfected++;
-					}
-					toInfected(&entity, clock);
-					LOG_EVENT("A Human became infected\n");
+	// Here are performed natural processed of humans and infected
+	if (entity.type == HUMAN || entity.type == INFECTED) {
+		// giving birth
+		if (entity.gender == FEMALE && entity.children > 0) {
+			if (entity.origin + entity.borns <= clock) {
+				if (entity.type == HUMAN) {
+					stats->humanFemalesGivingBirth++;
+				} else {
+					stats->infectedFemalesGivingBirth++;
 				}
-			}
 
-			// Here are performed natural processed of humans and infected
-			if (entity.type == HUMAN || entity.type == INFECTED) {
-				// giving birth
-				if (entity.gender == FEMALE && entity.children > 0) {
-					if (entity.origin + entity.borns <= clock) {
-						if (entity.type == HUMAN) {
-							stats.humanFemalesGivingBirth++;
-						} else {
-							stats.infectedFemalesGivingBirth++;
-						}
-
-						Entity * freePtr;
-						while (entity.children > 0 && (freePtr =
-								getFreeAdjacent(input, output, x, y)) != NULL) {
-							Entity child = giveBirth(&entity, clock);
-							if (child.type == HUMAN) {
-								if (child.gender == FEMALE) {
-									stats.humanFemalesBorn++;
-								} else {
-									stats.humanMalesBorn++;
-								}
-							} else {
-								if (child.gender == FEMALE) {
-									stats.infectedFemalesBorn++;
-								} else {
-									stats.infectedMalesBorn++;
-								}
-							}
-							*freePtr = child;
-							LOG_EVENT("A %s child was born\n",
-									child.type == HUMAN ? "Human" : "Infected");
-						}
-					} else {
-						if (entity.type == HUMAN) {
-							stats.humanFemalesPregnant++;
-						} else {
-							stats.infectedFemalesPregnant++;
-						}
-					}
+				CellIndex freeIndex;
+				while (entity.children > 0 && (freeIndex =
+						getFreeAdjacent(input, output, index)) != NO_CELL) {
+					Entity child = giveBirth(&entity, clock);
+					countChild(&child, stats);
+					writeCell(output, freeIndex, &child);
 				}
-
-				// making love
-				if (entity.gender == FEMALE && entity.children == 0
-						&& clock >= entity.origin + entity.fertilityStart
-						&& clock < entity.origin + entity.fertilityEnd) { // can have baby
-					EntityPtr adjacentMale = findAdjacentFertileMale(input, x,
-							y, clock);
-					if (adjacentMale != NULL) {
-						stats.couplesMakingLove++;
-						makeLove(&entity, adjacentMale, clock, input->stats);
-
-						stats.childrenConceived += entity.children;
-						LOG_EVENT("A couple made love\n");
-					}
+			} else {
+				if (entity.type == HUMAN) {
+					stats->humanFemalesPregnant++;
+				} else {
+					stats->infectedFemalesPregnant++;
 				}
 			}
+		}
 
-			if (entity.type == HUMAN) {
-				if (entity.gender == FEMALE) {
-					stats.humanFemales++;
-				} else {
-					stats.humanMales++;
-				}
-			} else if (entity.type == INFECTED) {
-				if (entity.gender == FEMALE) {
-					stats.infectedFemales++;
-				} else {
-					stats.infectedMales++;
-				}
-			} else {
-				stats.zombies++;
+		// making love
+		if (entity.gender == FEMALE && entity.children == 0
+				&& clock >= entity.origin + entity.fertilityStart
+				&& clock < entity.origin + entity.fertilityEnd) { // can have baby
+			CellIndex adjacentMale = findAdjacentFertileMale(input,
+					index, clock);
+			if (adjacentMale != NO_CELL) {
+				Entity father;
+				readCell(input, adjacentMale, &father);
+				stats->couplesMakingLove++;
+				makeLove(&entity, &father, clock, input->fertilization);
+
+				stats->childrenConceived += entity.children;
+				LOG_EVENT("A couple made love\n");
 			}
+		}
+	}
 
-			// MOVEMENT
+	countEntity(&entity, stats);
 
-			bearing bearing_ = getBearing(input, x, y); // optimal bearing
-			bearing_ += getRandomBearing() * BEARING_FLUCTUATION;
+	// MOVEMENT
 
-			Direction dir = bearingToDirection(bearing_);
-			if (dir != STAY) {
-				double bearingRandomQuotient = (randomDouble() - 0.5)
-						* BEARING_ABS_QUOTIENT_VARIANCE
-						+ BEARING_ABS_QUOTIENT_MEAN;
-				entity.bearing = bearing_ / cabsf(bearing_)
-						* bearingRandomQuotient;
-			} else {
-				entity.bearing = bearing_;
+	bearing bearing_ = getBearing(input, index, &entity); // optimal bearing
+	Direction dir = chooseDirection(&entity, bearing_, clock);
+
+	// we will try to find the cell in the chosen direction
+	CellIndex destIndex = NO_CELL;
+	if (dir != STAY) {
+		destIndex = IF_CAN_MOVE_TO(index, dir);
+		if (randomDouble() < MOVEMENT_TRY_ALTERNATIVE) {
+			if (destIndex == NO_CELL) {
+				destIndex = IF_CAN_MOVE_TO(index, DIRECTION_CCW(dir));
+			}
+			if (destIndex == NO_CELL) {
+				destIndex = IF_CAN_MOVE_TO(index, DIRECTION_CW(dir));
 			}
+		}
+	}
+	if (destIndex == NO_CELL) {
+		destIndex = index;
+	}
 
-			// some randomness in direction
-			// the entity will never go in the opposite direction
-			if (dir != STAY) {
-				if (randomDouble() < getMaxSpeed(&entity, clock)) {
-					double dirRnd = randomDouble();
-					if (dirRnd < DIRECTION_MISSED) {
-						dir = DIRECTION_CCW(dir); // turn counter-clock-wise
-					} else if (dirRnd < DIRECTION_MISSED * 2) {
-						dir = DIRECTION_CW(dir); // turn clock-wise
-					} else if (dirRnd
-							> DIRECTION_FOLLOW + DIRECTION_MISSED * 2) {
-						dir = STAY;
-					}
-				} else {
-					dir = STAY;
-				}
+	// actual assignment of entity to its destination
+	writeCell(output, destIndex, &entity);
+}
+
+/**
+ * Distance in which simulateCell2 reads the input:
+ * getBearing looks at cells in distance two.
+ */
+#define RING_WIDTH 2
+
+/**
+ * Cells of a tile which simulateCell1 processes separately.
+ */
+typedef enum TilePart {
+	TILE_INNER, // cells which only the tile reads in simulateCell2
+	TILE_FRAME // the outer RING_WIDTH rows and columns
+} TilePart;
+
+/**
+ * Finds the ranges of rows of the column x of the tile which belong
+ * to the part. There are up to two ranges, from top to bottom.
+ * Returns the number of ranges.
+ */
+static int getColumnRanges(Tile tile, int x, TilePart part, int y1[2],
+		int y2[2]) {
+	int top = tile.y1 + RING_WIDTH;
+	int bottom = tile.y2 - RING_WIDTH;
+	bool inner = x >= tile.x1 + RING_WIDTH && x <= tile.x2 - RING_WIDTH
+			&& top <= bottom;
+	int count = 0;
+	if (part == TILE_INNER) {
+		if (inner) {
+			y1[count] = top;
+			y2[count++] = bottom;
+		}
+	} else if (!inner) {
+		y1[count] = tile.y1;
+		y2[count++] = tile.y2;
+	} else {
+		y1[count] = tile.y1;
+		y2[count++] = top - 1;
+		y1[count] = bottom + 1;
+		y2[count++] = tile.y2;
+	}
+	return count;
+}
+
+/**
+ * Applies simulateCell1 to the entities in rows y1 to y2 of the column.
+ */
+static void simulateColumn1(WorldPtr input, int x, int y1, int y2,
+		simClock clock, Stats * stats) {
+	// global coordinates of the row 0, the random streams use them
+	int globalX = input->globalXOffset + x - input->xStart;
+	int globalY = input->globalYOffset - input->yStart;
+	CellIndex first = CELL_INDEX(input, x, y1);
+	CellIndex last = CELL_INDEX(input, x, y2);
+	// only occupied cells are visited
+	// the word is copied because the entity may be cleared
+	for (CellIndex word = BIT_WORD(first); word <= BIT_WORD(last); word++) {
+		BitWord occupied = getWordBits(input->occupiedBits, word, first, last);
+		while (occupied != 0) {
+			CellIndex index = word * BITS_IN_WORD + LOWEST_BIT(occupied);
+			occupied &= occupied - 1;
+			setRandomStream(clock, globalX,
+					globalY + index - CELL_INDEX(input, x, 0),
+					RANDOM_STREAM_STEP1);
+			simulateCell1(input, index, clock, stats);
+		}
+	}
+}
+
+/**
+ * Applies simulateCell2 to the entities in rows y1 to y2 of the column,
+ * in reversed order if yFlip is set.
+ */
+static void simulateColumn2(WorldPtr input, WorldPtr output, int x, int y1,
+		int y2, bool yFlip, simClock clock, Stats * stats) {
+	int globalX = input->globalXOffset + x - input->xStart;
+	int globalY = input->globalYOffset - input->yStart;
+	CellIndex first = CELL_INDEX(input, x, y1);
+	CellIndex last = CELL_INDEX(input, x, y2);
+	CellIndex firstWord = BIT_WORD(first);
+	CellIndex lastWord = BIT_WORD(last);
+	// only occupied cells are visited, input is not changed here
+	for (CellIndex ww = firstWord; ww <= lastWord; ww++) {
+		CellIndex word = yFlip ? firstWord + lastWord - ww : ww;
+		BitWord occupied = getWordBits(input->occupiedBits, word, first, last);
+		while (occupied != 0) {
+			int bit;
+			if (yFlip) {
+				bit = HIGHEST_BIT(occupied);
+				occupied &= ~(1ULL << bit);
 			} else {
-				// if the entity would STAY, we'll try again to make it move
-				// to make the entity bearing variable in terms of absolute value
-				double bearingRandomQuotient = (randomDouble() - 0.5)
-						* BEARING_ABS_QUOTIENT_VARIANCE
-						+ BEARING_ABS_QUOTIENT_MEAN;
-
-				bearing_ += getRandomBearing() * bearingRandomQuotient;
-				dir = bearingToDirection(bearing_);
+				bit = LOWEST_BIT(occupied);
+				occupied &= occupied - 1;
 			}
+			CellIndex index = word * BITS_IN_WORD + bit;
+			setRandomStream(clock, globalX,
+					globalY + index - CELL_INDEX(input, x, 0),
+					RANDOM_STREAM_STEP2);
+			simulateCell2(input, output, index, clock, stats);
+		}
+	}
+}
 
-			// we will try to find the cell in the chosen direction
-			CellPtr destPtr = NULL;
-			if (dir != STAY) {
-				destPtr = IF_CAN_MOVE_TO(x, y, dir);
-				if (randomDouble() < MOVEMENT_TRY_ALTERNATIVE) {
-					if (destPtr == NULL) {
-						destPtr = IF_CAN_MOVE_TO(x, y, DIRECTION_CCW(dir));
-					}
-					if (destPtr == NULL) {
-						destPtr = IF_CAN_MOVE_TO(x, y, DIRECTION_CW(dir));
-					}
-				}
+/**
+ * Applies simulateCell1 to the entities of the frame of the tile.
+ */
+static void simulateFrame(WorldPtr input, WorldPtr output, Tile tile,
+		Stats * stats) {
+	int y1[2], y2[2];
+	for (int x = tile.x1; x <= tile.x2; x++) {
+		int count = getColumnRanges(tile, x, TILE_FRAME, y1, y2);
+		for (int r = 0; r < count; r++) {
+			simulateColumn1(input, x, y1[r], y2[r], output->clock, stats);
+		}
+	}
+}
+
+/**
+ * Applies simulateCell1 to the inner entities of the tile and
+ * simulateCell2 to all its entities, in one sweep over its columns.
+ * simulateCell2 reads cells in distance RING_WIDTH, so simulateCell1
+ * runs RING_WIDTH columns ahead; the frames are done before.
+ */
+static void simulateTile(WorldPtr input, WorldPtr output, Tile tile,
+		bool xFlip, bool yFlip, Stats * stats) {
+	simClock clock = output->clock;
+	int width = tile.x2 - tile.x1 + 1;
+	int y1[2], y2[2];
+	for (int i = 0; i < width + RING_WIDTH; i++) {
+		if (i < width) {
+			int x = xFlip ? tile.x2 - i : tile.x1 + i;
+			int count = getColumnRanges(tile, x, TILE_INNER, y1, y2);
+			for (int r = 0; r < count; r++) {
+				simulateColumn1(input, x, y1[r], y2[r], clock, stats);
 			}
-			if (destPtr == NULL) {
-				destPtr = GET_CELL_PTR(output, x, y);
+		}
+		if (i >= RING_WIDTH) {
+			int xx = i - RING_WIDTH;
+			int x = xFlip ? tile.x2 - xx : tile.x1 + xx;
+			simulateColumn2(input, output, x, tile.y1, tile.y2, yFlip, clock,
+					stats);
+		}
+	}
+}
+
+/**
+ * Returns whether simulateCell2 reads the border in the tile.
+ */
+static bool readsBorder(WorldPtr input, Tile tile) {
+	return tile.x1 < (int) input->xStart + RING_WIDTH
+			|| tile.x2 > (int) input->xEnd - RING_WIDTH
+			|| tile.y1 < (int) input->yStart + RING_WIDTH
+			|| tile.y2 > (int) input->yEnd - RING_WIDTH;
+}
+
+/**
+ * Parts of the step which are processed in one pass of simulateTiles.
+ */
+typedef enum Pass {
+	INTERIOR_PASS, // the frames and the tiles of the first phase
+	// which do not read the border
+	RING_PASS // the rest of the tiles, after the border
+} Pass;
+
+/**
+ * Applies simulateFrame and simulateTile to all the tiles.
+ * The frames of all the tiles are done first, so simulateCell2 sees
+ * simulateCell1 applied to all the cells around as in two separate sweeps
+ * (the border is seen before simulateCell1).
+ * The tiles are processed in TILE_PHASES phases. An entity writes and checks
+ * output cells only in distance one and reads input cells in distance
+ * RING_WIDTH, so the tiles of one phase, which are at least one tile apart,
+ * can be processed in parallel by the threads of the step and in any order.
+ * Each thread gets the same tiles in all the loops.
+ */
+__attribute__ ((unused)) // used without EXCHANGE_EVERY
+static void simulateTiles(WorldPtr input, WorldPtr output, Pass pass,
+		bool xFlip, bool yFlip) {
+	int phaseFlip = TILE_PHASE(xFlip, yFlip);
+	// stats are counted per thread and summed at the end of the step
+#ifdef _OPENMP
+	Stats * stats = &output->threadStats[omp_get_thread_num()].stats;
+#else
+	Stats * stats = &output->threadStats[0].stats;
+#endif
+	if (pass == INTERIOR_PASS) {
+		for (int phase = 0; phase < TILE_PHASES; phase++) {
+#ifdef _OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+			for (int t = input->phaseStarts[phase];
+					t < input->phaseStarts[phase + 1]; t++) {
+				simulateFrame(input, output, input->tiles[t], stats);
 			}
+		}
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+	}
 
-			// actual assignment of entity to its destination
-			*destPtr = entity;
+	for (int p = 0; p < TILE_PHASES; p++) {
+		int phase = p ^ phaseFlip;
+		if (pass == INTERIOR_PASS && p > 0) {
+			break;
 		}
-		unlockColumn(output, x);
+		// static scheduling is used because we suppose that the load
+		// is distributed evenly over the map
 #ifdef _OPENMP
-#pragma omp critical (StatsCriticalRegion2)
+#pragma omp for schedule(static)
 #endif
-		{
-			mergeStats(&output->stats, stats, true);
+		for (int t = input->phaseStarts[phase];
+				t < input->phaseStarts[phase + 1]; t++) {
+			Tile tile = input->tiles[t];
+			// the first phase is split by the border
+			if (p == 0 && readsBorder(input, tile) != (pass == RING_PASS)) {
+				continue;
+			}
+			simulateTile(input, output, tile, xFlip, yFlip, stats);
 		}
 	}
 }
 
-void simulateStep(WorldPtr input, WorldPtr output) {
-	output->clock = input->clock + 1;
-
-	sendRecieveBorder(input);
-	simulateStep1(input, output); // while waiting for input border
-	sendRecieveBorderFinish(input);
+#ifdef EXCHANGE_EVERY
+/**
+ * Bits of the cells 0, STEP_COLOURS, 2 * STEP_COLOURS... of a word.
+ */
+#define STEP_COLOUR_BITS 0x1084210842108421ULL
 
-	simulateStep2(input, output); // this needs input with border
+/**
+ * Returns the global coordinate of a local one of the world or its border.
+ * The border is wrapped around the periodic world, so its cells
+ * use the same random streams as in the process which owns them.
+ */
+static inline int getGlobal(int local, int start, int offset, int size) {
+	int global = (offset + local - start) % size;
+	return global < 0 ? global + size : global;
+}
 
-	sendReceiveGhosts(output);
-	resetWorld(input); // while waiting for ghost cell movement
-	sendReceiveGhostsFinish(output);
+/**
+ * Finds the ranges of rows y1 to y2 of the column x which are either all
+ * in the interior or all outside of it. Returns the number of ranges.
+ */
+static int getDeepRanges(WorldPtr input, int x, int y1, int y2, int from[3],
+		int to[3], bool interior[3]) {
+	int count = 0;
+	if (x < (int) input->xStart || x > (int) input->xEnd) {
+		from[count] = y1;
+		to[count] = y2;
+		interior[count++] = false;
+		return count;
+	}
+	if (y1 < (int) input->yStart) {
+		from[count] = y1;
+		to[count] = input->yStart - 1;
+		interior[count++] = false;
+	}
+	from[count] = input->yStart;
+	to[count] = input->yEnd;
+	interior[count++] = true;
+	if (y2 > (int) input->yEnd) {
+		from[count] = input->yEnd + 1;
+		to[count] = y2;
+		interior[count++] = false;
+	}
+	return count;
 }
 
 /**
- * Returns a MALE Living entity which is on an adjacent cell to the given one.
- * The MALE has to be able to reproduce.
+ * Applies simulateCell1 to the entities in rows y1 to y2 of the column,
+ * which may be in the border.
  */
-static EntityPtr findAdjacentFertileMale(WorldPtr world, int x, int y,
-		simClock clock) {
-	int permutation = randomInt(0, RANDOM_BASIC_DIRECTIONS - 1);
-	for (int i = 0; i < 4; i++) {
-		Direction dir = random_basic_directions[permutation][i];
-		EntityPtr entityPtr = GET_CELL_PTR_DIR(world, dir, x, y);
-		if (entityPtr->type == HUMAN || entityPtr->type == INFECTED) {
-			if (entityPtr->gender == MALE) {
-				if (clock >= entityPtr->origin + entityPtr->fertilityStart
-						&& clock
-								< entityPtr->origin + entityPtr->fertilityEnd) {
-					return entityPtr;
-				}
-			}
+static void simulateDeepColumn1(WorldPtr input, int x, int y1, int y2,
+		simClock clock, Stats * stats) {
+	int globalX = getGlobal(x, input->xStart, input->globalXOffset,
+			input->globalWidth);
+	CellIndex column = CELL_INDEX(input, x, 0);
+	CellIndex first = CELL_INDEX(input, x, y1);
+	CellIndex last = CELL_INDEX(input, x, y2);
+	for (CellIndex word = BIT_WORD(first); word <= BIT_WORD(last); word++) {
+		BitWord occupied = getWordBits(input->occupiedBits, word, first, last);
+		while (occupied != 0) {
+			CellIndex index = word * BITS_IN_WORD + LOWEST_BIT(occupied);
+			occupied &= occupied - 1;
+			setRandomStream(clock, globalX,
+					getGlobal(index - column, input->yStart,
+							input->globalYOffset, input->globalHeight),
+					RANDOM_STREAM_STEP1);
+			simulateCell1(input, index, clock, stats);
 		}
 	}
-	return NULL;
 }
 
 /**
- * Returns the number of zombies in the cells bordering the cell at [x, y].
+ * Applies simulateCell2 to the entities of the colour
+ * in rows y1 to y2 of the column, which may be in the border.
  */
-static int countNeighbouringZombies(WorldPtr world, int x, int y) {
-	int zombies = 0;
-	for (int dir = DIRECTION_START; dir <= DIRECTION_BASIC; dir++) {
-		if (GET_CELL_DIR(world, dir, x, y).type == ZOMBIE) {
-			zombies++;
+static void simulateDeepColumn2(WorldPtr input, WorldPtr output, int x,
+		int y1, int y2, int colour, simClock clock, Stats * stats) {
+	int globalX = getGlobal(x, input->xStart, input->globalXOffset,
+			input->globalWidth);
+	CellIndex column = CELL_INDEX(input, x, 0);
+	CellIndex first = CELL_INDEX(input, x, y1);
+	CellIndex last = CELL_INDEX(input, x, y2);
+	for (CellIndex word = BIT_WORD(first); word <= BIT_WORD(last); word++) {
+		// the global row of the first bit decides which bits have the colour,
+		// the width and height are multiples of STEP_COLOURS
+		int y = word * BITS_IN_WORD - column;
+		int globalY = getGlobal(y, input->yStart, input->globalYOffset,
+				input->globalHeight);
+		int shift = (STEP_COLOURS - STEP_COLOUR(globalX, globalY) + colour)
+				* 3 % STEP_COLOURS; // 3 is the inverse of 2
+		BitWord occupied = getWordBits(input->occupiedBits, word, first, last)
+				& STEP_COLOUR_BITS << shift;
+		while (occupied != 0) {
+			CellIndex index = word * BITS_IN_WORD + LOWEST_BIT(occupied);
+			occupied &= occupied - 1;
+			setRandomStream(clock, globalX,
+					getGlobal(index - column, input->yStart,
+							input->globalYOffset, input->globalHeight),
+					RANDOM_STREAM_STEP2);
+			simulateCell2(input, output, index, clock, stats);
 		}
 	}
-	return zombies;
 }
 
 /**
- * Returns the optimal bearing for an entity based on twelve adjacent cells:
- * __#__
- * _###_
- * ##@##
- * _###_
- * __#__
- * The cells in distance one and two are handled separately.
- * For each cell (and its entity) it is calculated the suitability to go that direction.
- * This may can produce a result which points to a cell which is occupied.
- * It is an intentional feature.
+ * Applies simulateCell1 and then simulateCell2 in the phases of colours
+ * to the entities in distance margin from the interior, or only
+ * to those which are not in the interior if its simulateCell1 is done.
+ * Only the entities in the interior are counted in the stats.
  */
-static bearing getBearing(WorldPtr world, int x, int y) {
-	Entity entity = GET_CELL(world, x, y);
-	bearing bearing_ = entity.bearing;
-
-	for (int dir = DIRECTION_START; dir <= DIRECTION_BASIC; dir++) {
-		// all destinations are in the world
-		CellPtr cellPtr = GET_CELL_PTR_DIR(world, dir, x, y);
-		bearing delta = BEARING_FROM_DIRECTION(dir);
-
-		if (entity.type == ZOMBIE) {
-			if (cellPtr->type == NONE) {
-				bearing_ += delta * BEARING_RATE_ZOMBIE_EMPTY_ONE;
-			} else if (cellPtr->type == ZOMBIE) {
-				bearing_ += delta * BEARING_RATE_ZOMBIE_ZOMBIE_ONE;
-			} else {
-				bearing_ += delta * BEARING_RATE_ZOMBIE_LIVING_ONE;
+static void simulateDeepCells(WorldPtr input, WorldPtr output, int margin,
+		bool interiorDone, int firstColour) {
+	simClock clock = output->clock;
+	int x1 = input->xStart - margin;
+	int x2 = input->xEnd + margin;
+	int y1 = input->yStart - margin;
+	int y2 = input->yEnd + margin;
+#ifdef _OPENMP
+	Stats * stats = &output->threadStats[omp_get_thread_num()].stats;
+#else
+	Stats * stats = &output->threadStats[0].stats;
+#endif
+	Stats borderStats = NO_STATS; // the border is counted by its owner
+	int from[3], to[3];
+	bool interior[3];
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+	for (int x = x1; x <= x2; x++) {
+		int count = getDeepRanges(input, x, y1, y2, from, to, interior);
+		for (int r = 0; r < count; r++) {
+			if (!interior[r] || !interiorDone) {
+				simulateDeepColumn1(input, x, from[r], to[r], clock,
+						interior[r] ? stats : &borderStats);
 			}
-		} else {
-			if (cellPtr->type == NONE) {
-				bearing_ += delta * BEARING_RATE_LIVING_EMPTY_ONE;
-			} else if (cellPtr->type == ZOMBIE) {
-				bearing_ += delta * BEARING_RATE_LIVING_ZOMBIE_ONE;
-			} else if (cellPtr->gender != entity.gender) {
-				bearing_ += delta * BEARING_RATE_LIVING_OPPOSITE_SEX_ONE;
-			} else {
-				bearing_ += delta * BEARING_RATE_LIVING_SAME_SEX_ONE;
+		}
+	}
+	// the cells of a colour do not depend on each other,
+	// so the columns may be processed in any order
+	for (int c = 0; c < STEP_COLOURS; c++) {
+		int colour = (firstColour + c) % STEP_COLOURS;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int x = x1; x <= x2; x++) {
+			int count = getDeepRanges(input, x, y1, y2, from, to, interior);
+			for (int r = 0; r < count; r++) {
+				simulateDeepColumn2(input, output, x, from[r], to[r], colour,
+						clock, interior[r] ? stats : &borderStats);
 			}
 		}
 	}
-	for (int dir = DIRECTION_BASIC + 1; dir <= DIRECTION_ALL; dir++) {
-		CellPtr cellPtr = GET_CELL_PTR_DIR(world, dir, x, y);
-		bearing delta = BEARING_FROM_DIRECTION(dir);
-		delta /= cabsf(delta);
+}
 
-		if (entity.type == ZOMBIE) {
-			if (cellPtr->type == NONE) {
-				bearing_ += delta * BEARING_RATE_ZOMBIE_EMPTY_TWO;
-			} else if (cellPtr->type == ZOMBIE) {
-				bearing_ += delta * BEARING_RATE_ZOMBIE_ZOMBIE_TWO;
-			} else {
-				bearing_ += delta * BEARING_RATE_ZOMBIE_LIVING_TWO;
-			}
-		} else {
-			if (cellPtr->type == NONE) {
-				bearing_ += delta * BEARING_RATE_LIVING_EMPTY_TWO;
-			} else if (cellPtr->type == ZOMBIE) {
-				bearing_ += delta * BEARING_RATE_LIVING_ZOMBIE_TWO;
-			} else if (cellPtr->gender != entity.gender) {
-				bearing_ += delta * BEARING_RATE_LIVING_OPPOSITE_SEX_TWO;
-			} else {
-				bearing_ += delta * BEARING_RATE_LIVING_SAME_SEX_TWO;
-			}
+/**
+ * Applies simulateCell1 to the interior while the deep border is exchanged.
+ */
+static void simulateDeepInterior1(WorldPtr input, WorldPtr output) {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+	for (int x = input->xStart; x <= input->xEnd; x++) {
+#ifdef _OPENMP
+		Stats * stats = &output->threadStats[omp_get_thread_num()].stats;
+#else
+		Stats * stats = &output->threadStats[0].stats;
+#endif
+		simulateDeepColumn1(input, x, input->yStart, input->yEnd,
+				output->clock, stats);
+	}
+}
+
+/**
+ * The step with EXCHANGE_EVERY. The border is exchanged only when
+ * the steps for which it is valid run out. Until then, the processes
+ * simulate the border as well, the same way as its owners do,
+ * and the output is valid in STEP_RADIUS cells less of it.
+ */
+static void simulateDeepStep(WorldPtr input, WorldPtr output,
+		int firstColour) {
+	// each thread reads the steps, only the output ones are changed
+	int haloSteps = input->haloSteps;
+	bool exchange = haloSteps == 0;
+	if (exchange) {
+		sendRecieveBorder(input);
+		// while waiting for input border
+		simulateDeepInterior1(input, output);
+		sendRecieveBorderFinish(input);
+		haloSteps = EXCHANGE_EVERY;
+	} else {
+		// the stats reduction which the border would finish
+		reduceStatsFinish(input);
+	}
+	simulateDeepCells(input, output, STEP_RADIUS * haloSteps, exchange,
+			firstColour);
+
+#ifdef _OPENMP
+#pragma omp single
+#endif
+	{
+		output->haloSteps = haloSteps - 1;
+		reduceThreadStats(&output->stats, output->threadStats,
+				output->threadCount);
+	}
+	reduceStats(output); // finished with the border or in the next step
+	resetWorld(input);
+}
+#endif
+
+/**
+ * Returns the stats which control births in the step from input to output.
+ * With MPI, these are the stats of the whole world one step older than
+ * input, their reduction finished with the border in the previous step.
+ * The local stats are used until then.
+ */
+static const Stats * getBirthControlStats(WorldPtr input, WorldPtr output) {
+#ifdef USE_MPI
+	if (output->globalStats.clock >= 0) {
+		return &output->globalStats;
+	}
+#endif
+	return &input->stats;
+}
+
+void simulateStep(WorldPtr input, WorldPtr output) {
+	output->clock = input->clock + 1;
+	input->fertilization = getFertilizationProbability(
+			getBirthControlStats(input, output));
+
+	// notice that the columns and rows are randomly processed in one of
+	// two directions, the order of phases is switched as well
+	// the same in all the processes
+	setRandomStream(output->clock, 0, 0, RANDOM_STREAM_WORLD);
+#ifdef EXCHANGE_EVERY
+	// the phases of colours start with a random one
+	int firstColour = randomInt(0, STEP_COLOURS - 1);
+#else
+	bool xFlip = randomDouble() >= 0.5;
+	bool yFlip = randomDouble() >= 0.5;
+#endif
+
+	// the threads are forked once for the whole step, all of them
+	// run the passes below and share their loops, separated by the barriers
+	// of the loops, and only the master thread calls MPI
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+#ifdef EXCHANGE_EVERY
+		simulateDeepStep(input, output, firstColour);
+#else
+		sendRecieveBorder(input);
+		// while waiting for input border
+		simulateTiles(input, output, INTERIOR_PASS, xFlip, yFlip);
+		sendRecieveBorderFinish(input);
+
+		simulateTiles(input, output, RING_PASS, xFlip, yFlip); // needs border
+#ifdef _OPENMP
+#pragma omp single
+#endif
+		reduceThreadStats(&output->stats, output->threadStats,
+				output->threadCount);
+
+		sendReceiveGhosts(output);
+		reduceStats(output); // finished with the border in the next step
+		resetWorld(input); // while waiting for ghost cell movement
+		sendReceiveGhostsFinish(output);
+#endif
+	}
+}
+
+/**
+ * Returns a MALE Living entity which is on an adjacent cell to the given one.
+ * The MALE has to be able to reproduce.
+ */
+static CellIndex findAdjacentFertileMale(WorldPtr world, CellIndex index,
+		simClock clock) {
+	int permutation = randomInt(0, RANDOM_BASIC_DIRECTIONS - 1);
+	unsigned int males = getAdjacentBits(world, world->livingBits, index)
+			& ~getAdjacentBits(world, world->femaleBits, index);
+	if (males == 0) {
+		return NO_CELL;
+	}
+	for (int i = 0; i < 4; i++) {
+		Direction dir = random_basic_directions[permutation][i];
+		if ((males & DIRECTION_BIT(dir)) == 0) {
+			continue;
+		}
+		CellIndex maleIndex = CELL_INDEX_DIR(world, dir, index);
+		simClock origin = GET_ORIGIN(world, maleIndex);
+		if (clock >= origin + GET_FERTILITY_START(world, maleIndex)
+				&& clock < origin + GET_FERTILITY_END(world, maleIndex)) {
+			return maleIndex;
 		}
 	}
+	return NO_CELL;
+}
 
-	return bearing_;
+/**
+ * Returns the number of zombies in the cells bordering the given cell.
+ */
+static int countNeighbouringZombies(WorldPtr world, CellIndex index) {
+	return __builtin_popcount(
+			getAdjacentBits(world, world->zombieBits, index));
 }
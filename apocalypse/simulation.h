@@ -2,11 +2,52 @@
 #define SIMULATION_H_
 
 #include "world.h"
+#include "entity.h"
+#include "stats.h"
 
 /**
  * Runs one step of the world simulation.
  * The implementation should use the input map only for reading.
+ * The whole step is one parallel region; with MPI, only its master
+ * thread calls MPI, so MPI_THREAD_FUNNELED is enough.
  */
 void simulateStep(WorldPtr input, WorldPtr output);
 
+/**
+ * The rules which do not depend on the neighbourhood.
+ * They are shared by simulateStep and the agent engine.
+ */
+
+/**
+ * Order of actions:
+ * a) death of human or infected
+ * b) decomposition of zombie
+ * c) transition of infected to zombie
+ * The type of the entity is NONE when it died or decomposed.
+ */
+void simulateEntity1(EntityPtr entity, simClock clock, Stats * stats);
+
+/**
+ * Transition of a human into infected.
+ * It is more likely the more zombies are adjacent.
+ */
+void infectEntity(EntityPtr entity, int zombieCount, simClock clock,
+		Stats * stats);
+
+/**
+ * Counts a newborn child.
+ */
+void countChild(EntityPtr child, Stats * stats);
+
+/**
+ * Counts the entity to the population.
+ */
+void countEntity(EntityPtr entity, Stats * stats);
+
+/**
+ * Adds randomness to the optimal bearing, stores the new bearing
+ * into the entity and returns the direction in which the entity wants to go.
+ */
+Direction chooseDirection(EntityPtr entity, bearing bearing_, simClock clock);
+
 #endif /* SIMULATION_H_ */
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "stats.h"
 
 void mergeStats(Stats * dest, Stats src, bool absolute) {
@@ -36,3 +38,23 @@ void mergeStats(Stats * dest, Stats src, bool absolute) {
 	dest->infectedFemalesBecameZombies += src.infectedFemalesBecameZombies;
 	dest->infectedMalesBecameZombies += src.infectedMalesBecameZombies;
 }
+
+ThreadStats * newThreadStats(int count) {
+	void * memory;
+	if (posix_memalign(&memory, CACHE_LINE, sizeof(ThreadStats) * count)
+			!= 0) {
+		return NULL;
+	}
+	ThreadStats * threadStats = (ThreadStats *) memory;
+	for (int i = 0; i < count; i++) {
+		threadStats[i].stats = NO_STATS;
+	}
+	return threadStats;
+}
+
+void reduceThreadStats(Stats * dest, ThreadStats * threadStats, int count) {
+	for (int i = 0; i < count; i++) {
+		mergeStats(dest, threadStats[i].stats, true);
+		threadStats[i].stats = NO_STATS;
+	}
+}
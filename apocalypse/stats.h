@@ -2,6 +2,7 @@
 #define STATS_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "clock.h"
 
@@ -11,37 +12,68 @@ typedef struct Stats {
 	int width;
 	int height;
 
-	// entities related
-	int humanFemales;
-	int humanMales;
-	int infectedFemales;
-	int infectedMales;
-	int zombies;
-	int humanFemalesDied;
-	int humanMalesDied;
-	int infectedFemalesDied;
-	int infectedMalesDied;
-	int zombiesDecomposed;
-	int humanFemalesBorn;
-	int humanMalesBorn;
-	int humanFemalesGivingBirth;
-	int humanFemalesPregnant;
-	int infectedFemalesBorn;
-	int infectedMalesBorn;
-	int infectedFemalesGivingBirth;
-	int infectedFemalesPregnant;
-	int couplesMakingLove;
-	int childrenConceived;
-	int humanFemalesBecameInfected;
-	int humanMalesBecameInfected;
-	int infectedFemalesBecameZombies;
-	int infectedMalesBecameZombies;
+	// entities related, 64 bits do not overflow on large worlds
+	long long humanFemales;
+	long long humanMales;
+	long long infectedFemales;
+	long long infectedMales;
+	long long zombies;
+	long long humanFemalesDied;
+	long long humanMalesDied;
+	long long infectedFemalesDied;
+	long long infectedMalesDied;
+	long long zombiesDecomposed;
+	long long humanFemalesBorn;
+	long long humanMalesBorn;
+	long long humanFemalesGivingBirth;
+	long long humanFemalesPregnant;
+	long long infectedFemalesBorn;
+	long long infectedMalesBorn;
+	long long infectedFemalesGivingBirth;
+	long long infectedFemalesPregnant;
+	long long couplesMakingLove;
+	long long childrenConceived;
+	long long humanFemalesBecameInfected;
+	long long humanMalesBecameInfected;
+	long long infectedFemalesBecameZombies;
+	long long infectedMalesBecameZombies;
 } Stats;
 
 #define NO_STATS ((const struct Stats) {0})
 
+/**
+ * Count of the entity counters, which follow each other from humanFemales
+ * to the end of Stats. MPI sums them up over the processes.
+ */
+#define STATS_COUNTERS \
+	((sizeof(Stats) - offsetof(Stats, humanFemales)) / sizeof(long long))
+
 void mergeStats(Stats * dest, Stats src, bool absolute);
 
+/**
+ * Size of a cache line in bytes.
+ */
+#define CACHE_LINE 64
+
+/**
+ * Stats of one thread. They are aligned to whole cache lines,
+ * so the threads do not write to the same line.
+ */
+typedef struct ThreadStats {
+	Stats stats;
+} __attribute__((aligned(CACHE_LINE))) ThreadStats;
+
+/**
+ * Allocates zeroed stats for the count of threads.
+ * Returns NULL if they cannot be allocated.
+ */
+ThreadStats * newThreadStats(int count);
+
+/**
+ * Adds the stats of all the threads to dest and zeroes them.
+ */
+void reduceThreadStats(Stats * dest, ThreadStats * threadStats, int count);
+
 #endif /* STATS_H_ */
 
 // vim: ts=4 sw=4 et
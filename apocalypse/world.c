@@ -1,5 +1,100 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 #include "world.h"
+#include "common.h"
 #include "random.h"
+#include "halo.h"
+#include "log.h"
+
+// empty cells and bits are zero, so the new pages need no initialisation
+#ifdef SOA_WORLD
+_Static_assert(KIND(NONE, MALE) == 0, "An empty cell must be zero");
+#else
+_Static_assert(NONE == 0, "An empty cell must be zero");
+#endif
+
+void getCellPlanes(WorldPtr world, void * bases[CELL_PLANES],
+		size_t sizes[CELL_PLANES]) {
+#ifdef SOA_WORLD
+	bases[0] = world->kinds;
+	sizes[0] = sizeof(unsigned char);
+	bases[1] = world->origins;
+	sizes[1] = sizeof(int);
+	bases[2] = world->fertility;
+	sizes[2] = sizeof(FertilityWindow);
+	bases[3] = world->pregnancies;
+	sizes[3] = sizeof(Pregnancy);
+	bases[4] = world->bearings;
+	sizes[4] = sizeof(StoredBearing);
+#else
+	bases[0] = world->map1d;
+	sizes[0] = sizeof(Cell);
+#endif
+}
+
+/**
+ * Maps zeroed pages of at least the given bytes, aligned to a page,
+ * so each column of the planes starts at a cache line as the stride
+ * is a multiple of BITS_IN_WORD. The pages are allocated only when
+ * they are touched first, see touchWorld. With HUGE_PAGES, explicit
+ * huge pages are tried first, then transparent ones are requested.
+ * The bytes are rounded up to the size which was mapped.
+ */
+static void * allocatePages(size_t * bytes) {
+#ifdef HUGE_PAGES
+	size_t hugeBytes = (*bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE
+			* HUGE_PAGE_SIZE;
+	void * hugePages = mmap(NULL, hugeBytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (hugePages != MAP_FAILED) {
+		*bytes = hugeBytes;
+		return hugePages;
+	}
+#endif
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	*bytes = (*bytes + pageSize - 1) / pageSize * pageSize;
+	void * pages = mmap(NULL, *bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED) {
+		LOG_ERROR("Could not map %zu bytes of the world\n", *bytes);
+		exit(1);
+	}
+#ifdef HUGE_PAGES
+	madvise(pages, *bytes, MADV_HUGEPAGE);
+#endif
+	return pages;
+}
+
+/**
+ * Allocates the memory of all the cell planes. With SHARED_HALOS,
+ * it is a window shared by the processes on the same node,
+ * so their halos can copy the lines of each other directly.
+ * The worlds are created in the same order by all the processes,
+ * so the windows of the same world match.
+ */
+static void * allocateCells(WorldPtr world, size_t bytes) {
+	world->cellsBytes = bytes;
+#ifdef SHARED_HALOS
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+			MPI_INFO_NULL, &world->nodeComm);
+	// each part stays in the memory close to the process which owns it
+	MPI_Info info;
+	MPI_Info_create(&info);
+	MPI_Info_set(info, "alloc_shared_noncontig", "true");
+	void * cells;
+	MPI_Win_allocate_shared(bytes, 1, info, world->nodeComm, &cells,
+			&world->window);
+	MPI_Info_free(&info);
+	// the accesses are synchronised by barriers of the node (see halo.c)
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, world->window);
+	return cells;
+#else
+	return allocatePages(&world->cellsBytes);
+#endif
+}
 
 WorldPtr newWorld(unsigned int width, unsigned int height) {
 	WorldPtr world = (WorldPtr) malloc(sizeof(World));
@@ -9,94 +104,350 @@ WorldPtr newWorld(unsigned int width, unsigned int height) {
 	world->stats.clock = world->clock;
 	world->stats.width = width;
 	world->stats.height = height;
+	world->fertilization = 0;
+
+#ifdef _OPENMP
+	world->threadCount = omp_get_max_threads();
+#else
+	world->threadCount = 1;
+#endif
+	world->threadStats = newThreadStats(world->threadCount);
+	if (world->threadStats == NULL) {
+		LOG_ERROR("Could not allocate the stats of %d threads\n",
+				world->threadCount);
+		exit(1);
+	}
 
 	world->globalColumns = 1;
 	world->globalRows = 1;
 	world->globalX = 0;
 	world->globalY = 0;
+	world->globalXOffset = 0;
+	world->globalYOffset = 0;
 	world->globalWidth = width;
 	world->globalHeight = height;
 
 	world->localWidth = world->globalWidth;
 	world->localHeight = world->globalHeight;
 
-	world->xStart = 2;
-	world->xEnd = width + 1;
-	world->yStart = 2;
-	world->yEnd = height + 1;
+	world->xStart = BORDER_WIDTH;
+	world->xEnd = width + BORDER_WIDTH - 1;
+	world->yStart = BORDER_WIDTH;
+	world->yEnd = height + BORDER_WIDTH - 1;
 
-#ifdef _OPENMP
-	world->locks = (omp_lock_t *) malloc(sizeof(omp_lock_t) * (width + 4));
-#endif
-	world->map1d = (Cell *) malloc(sizeof(Cell) * (width + 4) * (height + 4));
-	world->map = (Cell **) malloc(sizeof(Cell *) * (width + 4));
-	for (int x = 0; x < width + 4; x++) {
-		world->map[x] = world->map1d + x * (height + 4);
-		for (int y = 0; y < height + 4; y++) {
-			GET_CELL(world, x, y).type = NONE;
-		}
-#ifdef _OPENMP
-		omp_init_lock(world->locks + x);
+	// each column starts with a new word of the bit planes
+	world->stride = (height + 2 * BORDER_WIDTH + BITS_IN_WORD - 1)
+			/ BITS_IN_WORD * BITS_IN_WORD;
+	size_t cells = (size_t) (width + 2 * BORDER_WIDTH) * world->stride;
+#ifdef SOA_WORLD
+	// the planes are ordered by decreasing alignment
+	world->cells = allocateCells(world,
+			(sizeof(StoredBearing) + sizeof(FertilityWindow) + sizeof(int)
+					+ sizeof(Pregnancy) + sizeof(unsigned char)) * cells);
+	world->bearings = (StoredBearing *) world->cells;
+	world->fertility = (FertilityWindow *) (world->bearings + cells);
+	world->origins = (int *) (world->fertility + cells);
+	world->pregnancies = (Pregnancy *) (world->origins + cells);
+	world->kinds = (unsigned char *) (world->pregnancies + cells);
+#else
+	world->cells = allocateCells(world, sizeof(Cell) * cells);
+	world->map1d = (Cell *) world->cells;
+#endif
+	size_t words = cells / BITS_IN_WORD;
+	world->bitsBytes = 4 * words * sizeof(BitWord);
+	world->bits = (BitWord *) allocatePages(&world->bitsBytes);
+	world->occupiedBits = world->bits;
+	world->zombieBits = world->occupiedBits + words;
+	world->femaleBits = world->zombieBits + words;
+	world->livingBits = world->femaleBits + words;
+
+	world->tiles = NULL;
+	makeTiles(world);
+	touchWorld(world);
+#ifdef EXCHANGE_EVERY
+	world->haloSteps = 0; // the border must be exchanged first
 #endif
-	}
 
 	return world;
 }
 
-void resetWorld(WorldPtr world) {
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) collapse(2)
+/**
+ * Position of the tile in the order in which the tiles are processed.
+ * Column by column by default, or along the Z-order curve
+ * if TILE_ORDER_MORTON is defined.
+ */
+static unsigned long tileOrder(int tileX, int tileY) {
+#ifdef TILE_ORDER_MORTON
+	unsigned long order = 0;
+	for (int bit = 0; bit < 16; bit++) {
+		order |= (unsigned long) ((tileX >> bit) & 1) << (2 * bit + 1);
+		order |= (unsigned long) ((tileY >> bit) & 1) << (2 * bit);
+	}
+	return order;
+#else
+	return (unsigned long) tileX << 32 | tileY;
 #endif
-	for (int x = 0; x < world->localWidth + 4; x++) {
-		for (int y = 0; y < world->localHeight + 4; y++) {
-			GET_CELL(world, x, y).type = NONE;
+}
+
+typedef struct TileKey {
+	unsigned long key;
+	Tile tile;
+} TileKey;
+
+static int compareTileKeys(const void * a, const void * b) {
+	unsigned long keyA = ((const TileKey *) a)->key;
+	unsigned long keyB = ((const TileKey *) b)->key;
+	return (keyA > keyB) - (keyA < keyB);
+}
+
+void makeTiles(WorldPtr world) {
+	// rows of tiles are aligned to TILE_HEIGHT, the columns to xStart
+	int tileColumns = (world->xEnd - world->xStart) / TILE_WIDTH + 1;
+	int firstRow = world->yStart / TILE_HEIGHT;
+	int tileRows = world->yEnd / TILE_HEIGHT - firstRow + 1;
+	int count = tileColumns * tileRows;
+
+	TileKey * keys = (TileKey *) malloc(sizeof(TileKey) * count);
+	for (int tx = 0; tx < tileColumns; tx++) {
+		for (int ty = 0; ty < tileRows; ty++) {
+			TileKey * key = keys + tx * tileRows + ty;
+			key->tile.x1 = world->xStart + tx * TILE_WIDTH;
+			key->tile.x2 = MIN(key->tile.x1 + TILE_WIDTH - 1, world->xEnd);
+			key->tile.y1 = MAX((firstRow + ty) * TILE_HEIGHT, world->yStart);
+			key->tile.y2 = MIN((firstRow + ty + 1) * TILE_HEIGHT - 1,
+					world->yEnd);
+			key->key = (unsigned long) TILE_PHASE(tx, ty) << 62
+					| tileOrder(tx, ty);
 		}
 	}
+	qsort(keys, count, sizeof(TileKey), compareTileKeys);
 
-	world->stats = NO_STATS;
-	world->stats.width = world->localWidth;
-	world->stats.height = world->localHeight;
+	free(world->tiles);
+	world->tiles = (Tile *) malloc(sizeof(Tile) * count);
+	world->tileCount = count;
+	int phase = 0;
+	world->phaseStarts[0] = 0;
+	for (int t = 0; t < count; t++) {
+		world->tiles[t] = keys[t].tile;
+		while ((int) (keys[t].key >> 62) > phase) {
+			world->phaseStarts[++phase] = t;
+		}
+	}
+	while (phase < TILE_PHASES) {
+		world->phaseStarts[++phase] = count;
+	}
+	free(keys);
 }
 
-void destroyWorld(WorldPtr world) {
+/**
+ * Returns the cells of the tile together with the borders
+ * and the padding of the columns if it is at the edge.
+ * The rows are always whole words of the bit planes.
+ */
+static Tile getTileCells(WorldPtr world, Tile tile) {
+	Tile cells;
+	cells.x1 = tile.x1 == world->xStart ? 0 : tile.x1;
+	cells.x2 = tile.x2 == world->xEnd ? world->xEnd + BORDER_WIDTH : tile.x2;
+	cells.y1 = tile.y1 == world->yStart ? 0 : tile.y1;
+	cells.y2 = tile.y2 == world->yEnd ? world->stride - 1 : tile.y2;
+	return cells;
+}
+
+void touchWorld(WorldPtr world) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+	size_t words = world->bitsBytes / (4 * sizeof(BitWord));
+	// the pages are touched by the same threads which process the tiles,
+	// the same way as in resetWorld
 #ifdef _OPENMP
-	for (unsigned int x = 0; x < world->localWidth + 4; x++) {
-		omp_destroy_lock(world->locks + x);
-	}
+#pragma omp parallel
 #endif
-	free(world->map1d);
-	free(world->map);
+	for (int phase = 0; phase < TILE_PHASES; phase++) {
 #ifdef _OPENMP
-	free(world->locks);
+#pragma omp for schedule(static) nowait
 #endif
-	free(world);
+		for (int t = world->phaseStarts[phase];
+				t < world->phaseStarts[phase + 1]; t++) {
+			Tile cells = getTileCells(world, world->tiles[t]);
+			size_t count = cells.y2 - cells.y1 + 1;
+			for (int x = cells.x1; x <= cells.x2; x++) {
+				CellIndex first = CELL_INDEX(world, x, cells.y1);
+				for (int p = 0; p < CELL_PLANES; p++) {
+					memset((char *) bases[p] + first * sizes[p], 0,
+							count * sizes[p]);
+				}
+				for (int b = 0; b < 4; b++) {
+					memset(world->bits + b * words + BIT_WORD(first), 0,
+							count / BITS_IN_WORD * sizeof(BitWord));
+				}
+			}
+		}
+	}
 }
 
-void lockColumn(WorldPtr world, int x) {
+/**
+ * Reads the pages of the mapping which contains the address on each
+ * NUMA node, as N0=pages N1=pages... The mappings are listed by their
+ * starts in increasing order. Nodes stay empty if Linux does not tell.
+ */
+static void readNumaNodes(void * address, char * nodes, size_t size) {
+	nodes[0] = '\0';
+	FILE * file = fopen("/proc/self/numa_maps", "r");
+	if (file == NULL) {
+		return;
+	}
+	char line[4096], mapping[4096] = "";
+	while (fgets(line, sizeof(line), file) != NULL
+			&& strtoul(line, NULL, 16) <= (unsigned long) address) {
+		strcpy(mapping, line);
+	}
+	fclose(file);
+	for (char * token = strtok(mapping, " \n"); token != NULL;
+			token = strtok(NULL, " \n")) {
+		if (token[0] == 'N' && token[1] >= '0' && token[1] <= '9'
+				&& strlen(nodes) + strlen(token) + 2 < size) {
+			strcat(strcat(nodes, nodes[0] != '\0' ? " " : ""), token);
+		}
+	}
+}
+
+/**
+ * Reads the size of the pages of the mapping which contains the address
+ * and how much of it is in transparent huge pages, both in kB.
+ * Both stay zero if Linux does not tell.
+ */
+static void readPageSizes(void * address, long * pageSize, long * hugePages) {
+	*pageSize = 0;
+	*hugePages = 0;
+	FILE * file = fopen("/proc/self/smaps", "r");
+	if (file == NULL) {
+		return;
+	}
+	// the range of the mapping is followed by lines of its fields
+	char line[4096];
+	bool inside = false;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned long start, end;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			inside = start <= (unsigned long) address
+					&& (unsigned long) address < end;
+		} else if (inside) {
+			sscanf(line, "KernelPageSize: %ld", pageSize);
+			sscanf(line, "AnonHugePages: %ld", hugePages);
+		}
+	}
+	fclose(file);
+}
+
+void logWorldMemory(WorldPtr world) {
+	char nodes[256];
+	readNumaNodes(world->cells, nodes, sizeof(nodes));
+	long pageSize, hugePages;
+	readPageSizes(world->cells, &pageSize, &hugePages);
+	LOG_DEBUG("The cells take %.1f MB in pages of %ld kB "
+			"(%ld kB in transparent huge pages) on nodes: %s\n",
+			world->cellsBytes / 1048576.0, pageSize, hugePages,
+			nodes[0] != '\0' ? nodes : "unknown");
+}
+
+void resetWorld(WorldPtr world) {
+	// the tiles are reset by the same threads which process them,
+	// the tiles at the edges take the borders with them
+	// only the occupied cells are cleared, the rest is NONE already
+	for (int phase = 0; phase < TILE_PHASES; phase++) {
 #ifdef _OPENMP
-	for (int i = x - 1; i <= x + 1; i++) {
-		omp_set_lock(world->locks + i);
+#pragma omp for schedule(static) nowait
+#endif
+		for (int t = world->phaseStarts[phase];
+				t < world->phaseStarts[phase + 1]; t++) {
+			Tile cells = getTileCells(world, world->tiles[t]);
+			int x1 = cells.x1;
+			int x2 = cells.x2;
+			int y1 = cells.y1;
+			size_t words = (cells.y2 - y1 + 1) / BITS_IN_WORD;
+			for (int x = x1; x <= x2; x++) {
+				size_t firstWord = BIT_WORD(CELL_INDEX(world, x, y1));
+				for (size_t word = firstWord; word < firstWord + words;
+						word++) {
+					// the other planes are subsets of the occupied one
+					BitWord occupied = world->occupiedBits[word];
+					if (occupied == 0) {
+						continue;
+					}
+					world->occupiedBits[word] = 0;
+					world->zombieBits[word] = 0;
+					world->femaleBits[word] = 0;
+					world->livingBits[word] = 0;
+					while (occupied != 0) {
+						CellIndex index = word * BITS_IN_WORD
+								+ LOWEST_BIT(occupied);
+						occupied &= occupied - 1;
+#ifdef SOA_WORLD
+						world->kinds[index] = KIND(NONE, MALE);
+#else
+						world->map1d[index].type = NONE;
+#endif
+					}
+				}
+			}
+		}
+	}
+
+#ifdef _OPENMP
+#pragma omp single
+#endif
+	{
+		world->stats = NO_STATS;
+		world->stats.width = world->localWidth;
+		world->stats.height = world->localHeight;
 	}
+}
+
+void destroyWorld(WorldPtr world) {
+#ifdef USE_MPI
+	destroyHalo(&world->border);
+	destroyHalo(&world->ghosts);
 #endif
+#ifdef SHARED_HALOS
+	MPI_Win_unlock_all(world->window);
+	MPI_Win_free(&world->window);
+	MPI_Comm_free(&world->nodeComm);
+#else
+	munmap(world->cells, world->cellsBytes);
+#endif
+	munmap(world->bits, world->bitsBytes);
+	free(world->tiles);
+	free(world->threadStats);
+	free(world);
 }
 
-void unlockColumn(WorldPtr world, int x) {
+void refreshBits(WorldPtr world, int x1, int x2, int y1, int y2) {
+	// each column starts with a new word of the bit planes
 #ifdef _OPENMP
-	for (int i = x - 1; i <= x + 1; i++) {
-		omp_unset_lock(world->locks + i);
-	}
+#pragma omp for schedule(static)
 #endif
+	for (int x = x1; x <= x2; x++) {
+		for (int y = y1; y <= y2; y++) {
+			CellIndex index = CELL_INDEX(world, x, y);
+			updateCellBits(world, index, GET_TYPE(world, index),
+					GET_GENDER(world, index));
+		}
+	}
 }
 
-CellPtr getFreeAdjacent(WorldPtr input, WorldPtr output, int x, int y) {
-	CellPtr freePtr;
+CellIndex getFreeAdjacent(WorldPtr input, WorldPtr output, CellIndex index) {
 	int permutation = randomInt(0, RANDOM_BASIC_DIRECTIONS - 1);
+	unsigned int free = ~(getAdjacentBits(input, input->occupiedBits, index)
+			| getAdjacentBits(output, output->occupiedBits, index));
+	if ((free & ALL_DIRECTION_BITS) == 0) {
+		return NO_CELL;
+	}
 	for (int i = 0; i < 4; i++) {
 		Direction dir = random_basic_directions[permutation][i];
-		if (GET_CELL_DIR(input, dir, x, y).type == NONE && (freePtr =
-				GET_CELL_PTR_DIR(output, dir, x, y))->type == NONE) {
-			return freePtr;
+		if (free & DIRECTION_BIT(dir)) {
+			return CELL_INDEX_DIR(input, dir, index);
 		}
 	}
-	return NULL;
+	return NO_CELL;
 }
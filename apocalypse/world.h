@@ -7,6 +7,7 @@
 #define WORLD_H_
 
 #include <stdlib.h>
+#include <stdbool.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -17,28 +18,203 @@
 #include "stats.h"
 #include "mpistuff.h"
 
+/**
+ * The entity as it is stored in the world; see COMPACT_ENTITY.
+ */
+#ifdef COMPACT_ENTITY
+typedef CompactEntity Cell;
+#else
 typedef Entity Cell;
-typedef EntityPtr CellPtr;
+#endif
+
+/**
+ * Cells are addressed by a flat index: x * stride + y.
+ * NO_CELL is used as a NULL when a function looks for a cell.
+ */
+typedef long int CellIndex;
+
+#define NO_CELL ((CellIndex) -1)
+
+/**
+ * Next to the cells, the world keeps bit planes with one bit per cell.
+ * The stride is a multiple of BITS_IN_WORD, so the bit of a cell
+ * has the same index as the cell and every column starts a new word.
+ */
+typedef unsigned long long int BitWord;
+
+#define BITS_IN_WORD 64
+
+#define BIT_WORD(index) ((index) / BITS_IN_WORD)
+
+#define BIT_MASK(index) (1ULL << ((index) % BITS_IN_WORD))
+
+/**
+ * With HUGE_PAGES, the world is stored in explicit huge pages of this size
+ * when the system has them reserved, or in transparent ones otherwise.
+ */
+#ifdef HUGE_PAGES
+#define HUGE_PAGE_SIZE (2UL << 20)
+#endif
+
+#define TEST_BIT(plane, index) \
+		(((plane)[BIT_WORD(index)] & BIT_MASK(index)) != 0)
+
+#ifdef SOA_WORLD
+/**
+ * The structure-of-arrays storage splits the entity into planes.
+ * The kind plane is the only one which is read for all neighbours;
+ * the other planes are touched only for cells which are occupied.
+ */
+#define KIND_TYPE_MASK 0x3
+#define KIND_GENDER_SHIFT 2
+#define KIND(type, gender) \
+		((unsigned char) ((type) | ((gender) << KIND_GENDER_SHIFT)))
+
+typedef struct FertilityWindow {
+	simClockDelta fertilityStart :STORED_DELTA_BITS;
+	simClockDelta fertilityEnd :STORED_DELTA_BITS;
+	simClockDelta becameInfected :STORED_DELTA_BITS;
+#ifdef EVENT_LIFECYCLE
+	simClockDelta event :16;
+#endif
+} FertilityWindow;
+
+typedef struct Pregnancy {
+	unsigned int children :2;
+	unsigned int borns :STORED_DELTA_BITS;
+#ifdef EVENT_LIFECYCLE
+	unsigned int eventDue :1;
+#endif
+} Pregnancy;
+
+#define CELL_PLANES 5
+#else
+#define CELL_PLANES 1
+#endif
+
+/**
+ * The interior of the world is processed by tiles of TILE_WIDTH columns
+ * and TILE_HEIGHT rows. Both can be set at compile time.
+ * Tiles are aligned to the words of the bit planes,
+ * so TILE_HEIGHT must be a multiple of BITS_IN_WORD.
+ */
+#ifndef TILE_WIDTH
+#define TILE_WIDTH 32
+#endif
+#ifndef TILE_HEIGHT
+#define TILE_HEIGHT 512
+#endif
+#if TILE_WIDTH < 2 || TILE_HEIGHT % BITS_IN_WORD != 0
+#error "TILE_WIDTH must be at least 2 and TILE_HEIGHT a multiple of 64"
+#endif
+
+/**
+ * The tiles are coloured like a 2x2 chessboard. Tiles of one colour (phase)
+ * are separated by at least one whole tile, which is at least two cells wide,
+ * so an entity never touches a cell which is touched from other tile
+ * of the same phase.
+ */
+#define TILE_PHASES 4
+#define TILE_PHASE(tileX, tileY) (((tileX) & 1) | ((tileY) & 1) << 1)
+
+/**
+ * With EXCHANGE_EVERY, the border is exchanged once in that many steps,
+ * at least two, and the processes simulate it as well in between
+ * (without it, the default step exchanges it every step).
+ * Each cell must then be simulated the same way by all the processes
+ * which have it, so the entities are processed in STEP_COLOURS phases
+ * by the colour of their global position (see STEP_COLOUR) instead of
+ * by the tiles.
+ * The cells of one colour are at least three cells apart, so an entity
+ * does not see the changes made by the others of its phase,
+ * and the order within a phase does not matter.
+ * An entity reads the input in distance two and the output
+ * in distance one, which was written by the entities of earlier phases
+ * in distance two, so the output of a cell depends only on the input
+ * in distance STEP_RADIUS. The colours go on across the edges
+ * of the periodic world, so its width and height must be multiples
+ * of STEP_COLOURS.
+ */
+#ifdef EXCHANGE_EVERY
+#ifndef USE_MPI
+#error "EXCHANGE_EVERY is the period of the MPI exchange, use it with USE_MPI"
+#endif
+#if EXCHANGE_EVERY < 2
+#error "EXCHANGE_EVERY must be at least 2, leave it out to exchange every step"
+#endif
+#define STEP_COLOURS 5
+#define STEP_COLOUR(globalX, globalY) \
+		(((globalX) + 2 * (globalY)) % STEP_COLOURS)
+#define STEP_RADIUS (2 * STEP_COLOURS + 1)
+#endif
+
+/**
+ * The world has a border of BORDER_WIDTH cells around the interior.
+ * The entities read cells in distance two, so two cells are enough
+ * when the border is exchanged every step. The deep border
+ * of EXCHANGE_EVERY has BORDER_LINES cells, which are valid for
+ * that many steps, and the two cells which the outermost of them read.
+ */
+#ifdef EXCHANGE_EVERY
+#define BORDER_LINES (STEP_RADIUS * EXCHANGE_EVERY)
+#define BORDER_WIDTH (BORDER_LINES + 2)
+#else
+#define BORDER_LINES 2
+#define BORDER_WIDTH 2
+#endif
+
+/**
+ * A rectangle of interior cells. Bounds are inclusive.
+ */
+typedef struct Tile {
+	int x1;
+	int x2;
+	int y1;
+	int y2;
+} Tile;
 
 /**
  * The World contains a 2D map.
- * The map is slightly bigger to allow unchecked access to two cells in each direction.
+ * The map is slightly bigger to allow unchecked access to BORDER_WIDTH cells in each direction.
+ * It is stored column by column, see CELL_INDEX.
  * You should never iterate like this: for (int x = 0; x < w->width; x++)
  * But rather: for (int x = w->xStart; x <= w->xEnd; x++)
  * Remember that start and end are inclusive.
  * The main reason is to make it possible to divide the map into pieces
  * which will calculated independently on different nodes connected by MPI.
  *
- * As there is never access more than 2 cells from internal cell,
+ * As there is never access more than 2 cells from internal cell
+ * (or from the simulated cells of the deep border),
  * no border checks are necessary.
  *
- * Part of the world (set of three adjacent columns) can be locked.
+ * The cells must be changed only with writeCell, copyCell and clearCell,
+ * so the bit planes stay consistent with them.
  */
 typedef struct World {
 	simClock clock;
-	Cell ** map; // 2D array which is allocated as 1D
+	void * cells; // one allocation which holds all the planes
+	size_t cellsBytes; // the size of the allocation
+#ifdef SOA_WORLD
+	unsigned char * kinds; // type and gender
+	int * origins;
+	FertilityWindow * fertility;
+	Pregnancy * pregnancies;
+	StoredBearing * bearings;
+#else
 	Cell * map1d; // 1D array representation of the map
+#endif
+	unsigned int stride; // distance between two adjacent columns
+
+	BitWord * bits; // one allocation which holds all the bit planes
+	size_t bitsBytes; // the size of the allocation
+	BitWord * occupiedBits; // type != NONE
+	BitWord * zombieBits; // type == ZOMBIE
+	BitWord * femaleBits; // gender == FEMALE
+	BitWord * livingBits; // type == HUMAN || type == INFECTED
 	Stats stats; // stats first for the local then for the global world
+	double fertilization; // getFertilizationProbability of the stats
+	ThreadStats * threadStats; // stats of each thread during the step
+	int threadCount;
 
 	unsigned int globalWidth; // real width
 	unsigned int globalHeight; // real height
@@ -46,6 +222,8 @@ typedef struct World {
 	unsigned int globalRows;
 	unsigned int globalX;
 	unsigned int globalY;
+	unsigned int globalXOffset; // global x of the first interior column
+	unsigned int globalYOffset; // global y of the first interior row
 
 	unsigned int localWidth; // real width of this world part
 	unsigned int localHeight; // real height of this world part
@@ -55,70 +233,351 @@ typedef struct World {
 	unsigned int yStart; // first interior cell
 	unsigned int yEnd; // last interior cell
 
-#ifdef _OPENMP
-omp_lock_t * locks;
-#endif
+	Tile * tiles; // interior tiles sorted by phase
+	int tileCount;
+	int phaseStarts[TILE_PHASES + 1]; // first tile of each phase
+
 #ifdef USE_MPI
 MPI_Comm comm;
 MPI_Request requests[MAX_REQUESTS];
 int requestCount;
-MPI_Datatype rowType;
-MPI_Datatype columnType;
+Halo border; // exchanged when the world is the input
+Halo ghosts; // exchanged when the world is the output
+Stats sentStats; // local stats of the last step while they are reduced
+Stats globalStats; // stats of the whole world, reduced one step behind
+#endif
+#ifdef SHARED_HALOS
+MPI_Comm nodeComm; // the processes which share the memory of the cells
+MPI_Win window; // the cells shared with the processes on the same node
+#endif
+#ifdef EXCHANGE_EVERY
+int haloSteps; // steps for which the border is still valid
 #endif
 } World;
 
 typedef World * WorldPtr;
 
 /**
- * Returns the specified entity.
- * Does not check if the entity is in the world.
+ * Returns index of the specified cell.
+ * Does not check if the cell is in the world.
  */
-#define GET_CELL(worldPtr, x, y) \
-		((worldPtr)->map[(x)][(y)])
-
-#define GET_CELL_PTR(worldPtr, x, y) \
-		(&GET_CELL((worldPtr), (x), (y)))
+#define CELL_INDEX(worldPtr, x, y) \
+		((CellIndex) (x) * (worldPtr)->stride + (y))
 
 /**
- * Returns the cell in direction from specified cell.
+ * Returns index of the cell in direction from specified cell.
  * Does not check if the cell is in the world.
  */
-#define GET_CELL_DIR(worldPtr, dir, x, y) \
-		GET_CELL((worldPtr), (x) + direction_delta_x[(dir)], (y) + direction_delta_y[(dir)])
+#define CELL_INDEX_DIR(worldPtr, dir, index) \
+		((index) + (CellIndex) direction_delta_x[(dir)] * (worldPtr)->stride \
+				+ direction_delta_y[(dir)])
+
+/**
+ * Sets or clears one bit of a plane.
+ * Other threads may change other bits of the same word.
+ */
+static inline void updateBit(BitWord * plane, CellIndex index, bool value) {
+	BitWord * word = plane + BIT_WORD(index);
+	BitWord mask = BIT_MASK(index);
+	// the word is read atomically as well, the others may be changing it
+	if (((__atomic_load_n(word, __ATOMIC_RELAXED) & mask) != 0) != value) {
+		if (value) {
+			__atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+		} else {
+			__atomic_fetch_and(word, ~mask, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/**
+ * Updates all the bit planes of a cell.
+ */
+static inline void updateCellBits(WorldPtr world, CellIndex index,
+		EntityType type, Gender gender) {
+	updateBit(world->occupiedBits, index, type != NONE);
+	updateBit(world->zombieBits, index, type == ZOMBIE);
+	updateBit(world->femaleBits, index, type != NONE && gender == FEMALE);
+	updateBit(world->livingBits, index, type == HUMAN || type == INFECTED);
+}
 
-#define GET_CELL_PTR_DIR(worldPtr, dir, x, y) \
-		(&GET_CELL_DIR((worldPtr), (dir), (x), (y)))
+/**
+ * Returns count bits (at most 57) starting with the bit of the given cell.
+ */
+static inline BitWord getBits(const BitWord * plane, CellIndex index,
+		int count) {
+	int offset = index % BITS_IN_WORD;
+	BitWord bits = plane[BIT_WORD(index)] >> offset;
+	if (offset + count > BITS_IN_WORD) {
+		bits |= plane[BIT_WORD(index) + 1] << (BITS_IN_WORD - offset);
+	}
+	return bits & ((1ULL << count) - 1);
+}
+
+/**
+ * Returns the word of the plane with only the bits of the cells
+ * from first to last (inclusive) left.
+ */
+static inline BitWord getWordBits(const BitWord * plane, CellIndex word,
+		CellIndex first, CellIndex last) {
+	BitWord bits = plane[word];
+	if (BIT_WORD(first) == word) {
+		bits &= ~0ULL << (first % BITS_IN_WORD);
+	}
+	if (BIT_WORD(last) == word) {
+		bits &= ~0ULL >> (BITS_IN_WORD - 1 - last % BITS_IN_WORD);
+	}
+	return bits;
+}
+
+/**
+ * Positions of the lowest and the highest set bit. Bits must not be zero.
+ */
+#define LOWEST_BIT(bits) __builtin_ctzll(bits)
+
+#define HIGHEST_BIT(bits) (BITS_IN_WORD - 1 - __builtin_clzll(bits))
+
+/**
+ * Bit of a basic direction in a mask returned by getAdjacentBits.
+ */
+#define DIRECTION_BIT(dir) (1 << ((dir) - DIRECTION_START))
+
+#define ALL_DIRECTION_BITS (DIRECTION_BIT(DIRECTION_BASIC + 1) - 1)
+
+/**
+ * Returns the bits of the four adjacent cells as a mask of DIRECTION_BITs.
+ * See also getNeighbourhoodBits.
+ */
+static inline unsigned int getAdjacentBits(WorldPtr world,
+		const BitWord * plane, CellIndex index) {
+	BitWord column = getBits(plane, index - 1, 3); // UP, the cell, DOWN
+	return TEST_BIT(plane, index - world->stride) * DIRECTION_BIT(LEFT)
+			| (column & 1) * DIRECTION_BIT(UP)
+			| TEST_BIT(plane, index + world->stride) * DIRECTION_BIT(RIGHT)
+			| (column >> 2) * DIRECTION_BIT(DOWN);
+}
+
+/**
+ * Returns the bits of the twelve cells in distance one and two
+ * as a mask of DIRECTION_BITs.
+ */
+static inline unsigned int getNeighbourhoodBits(WorldPtr world,
+		const BitWord * plane, CellIndex index) {
+	CellIndex stride = world->stride;
+	BitWord column = getBits(plane, index - 2, 5); // UU, UP, the cell, DOWN, DD
+	BitWord left = getBits(plane, index - stride - 1, 3); // UL, LEFT, DL
+	BitWord right = getBits(plane, index + stride - 1, 3); // UR, RIGHT, DR
+	return (left >> 1 & 1) * DIRECTION_BIT(LEFT)
+			| (column >> 1 & 1) * DIRECTION_BIT(UP)
+			| (right >> 1 & 1) * DIRECTION_BIT(RIGHT)
+			| (column >> 3 & 1) * DIRECTION_BIT(DOWN)
+			| TEST_BIT(plane, index - 2 * stride) * DIRECTION_BIT(LL)
+			| (left & 1) * DIRECTION_BIT(UL)
+			| (column & 1) * DIRECTION_BIT(UU)
+			| (right & 1) * DIRECTION_BIT(UR)
+			| TEST_BIT(plane, index + 2 * stride) * DIRECTION_BIT(RR)
+			| (right >> 2) * DIRECTION_BIT(DR)
+			| (column >> 4) * DIRECTION_BIT(DD)
+			| (left >> 2) * DIRECTION_BIT(DL);
+}
+
+#ifdef SOA_WORLD
+
+#define GET_TYPE(worldPtr, index) \
+		((EntityType) ((worldPtr)->kinds[(index)] & KIND_TYPE_MASK))
+
+#define GET_GENDER(worldPtr, index) \
+		((Gender) ((worldPtr)->kinds[(index)] >> KIND_GENDER_SHIFT))
+
+#define GET_ORIGIN(worldPtr, index) \
+		((simClock) (worldPtr)->origins[(index)])
+
+#define GET_CHILDREN(worldPtr, index) \
+		((worldPtr)->pregnancies[(index)].children)
+
+#define GET_FERTILITY_START(worldPtr, index) \
+		((worldPtr)->fertility[(index)].fertilityStart)
+
+#define GET_FERTILITY_END(worldPtr, index) \
+		((worldPtr)->fertility[(index)].fertilityEnd)
+
+/**
+ * Copies the entity from the cell.
+ */
+static inline void readCell(WorldPtr world, CellIndex index, EntityPtr entity) {
+	unsigned char kind = world->kinds[index];
+	entity->type = kind & KIND_TYPE_MASK;
+	entity->gender = kind >> KIND_GENDER_SHIFT;
+	entity->origin = world->origins[index];
+	FertilityWindow fertility = world->fertility[index];
+	entity->fertilityStart = fertility.fertilityStart;
+	entity->fertilityEnd = fertility.fertilityEnd;
+	entity->becameInfected = fertility.becameInfected;
+#ifdef EVENT_LIFECYCLE
+	entity->event = fertility.event;
+#endif
+	Pregnancy pregnancy = world->pregnancies[index];
+	entity->children = pregnancy.children;
+	entity->borns = pregnancy.borns;
+#ifdef EVENT_LIFECYCLE
+	entity->eventDue = pregnancy.eventDue;
+#endif
+	entity->bearing = LOAD_BEARING(world->bearings[index]);
+}
+
+/**
+ * Stores the entity into the cell.
+ */
+static inline void writeCell(WorldPtr world, CellIndex index, EntityPtr entity) {
+	world->kinds[index] = KIND(entity->type, entity->gender);
+	world->origins[index] = entity->origin;
+	world->fertility[index] = (FertilityWindow) {
+			STORE_DELTA(entity->fertilityStart),
+			STORE_DELTA(entity->fertilityEnd),
+			STORE_DELTA(entity->becameInfected),
+#ifdef EVENT_LIFECYCLE
+			entity->event,
+#endif
+			};
+	world->pregnancies[index] = (Pregnancy) { entity->children,
+			STORE_DELTA(entity->borns),
+#ifdef EVENT_LIFECYCLE
+			entity->eventDue,
+#endif
+			};
+	world->bearings[index] = STORE_BEARING(entity->bearing);
+	updateCellBits(world, index, entity->type, entity->gender);
+}
+
+/**
+ * Copies the whole cell between two (possibly the same) worlds.
+ */
+static inline void copyCell(WorldPtr dest, CellIndex destIndex, WorldPtr src,
+		CellIndex srcIndex) {
+	dest->kinds[destIndex] = src->kinds[srcIndex];
+	dest->origins[destIndex] = src->origins[srcIndex];
+	dest->fertility[destIndex] = src->fertility[srcIndex];
+	dest->pregnancies[destIndex] = src->pregnancies[srcIndex];
+	dest->bearings[destIndex] = src->bearings[srcIndex];
+	updateCellBits(dest, destIndex, GET_TYPE(dest, destIndex),
+			GET_GENDER(dest, destIndex));
+}
+
+/**
+ * Removes the entity from the cell.
+ */
+static inline void clearCell(WorldPtr world, CellIndex index) {
+	world->kinds[index] = KIND(NONE, MALE);
+	updateCellBits(world, index, NONE, MALE);
+}
+
+#else // array of entities
+
+#define GET_TYPE(worldPtr, index) \
+		((worldPtr)->map1d[(index)].type)
+
+#define GET_GENDER(worldPtr, index) \
+		((worldPtr)->map1d[(index)].gender)
+
+#define GET_ORIGIN(worldPtr, index) \
+		((simClock) (worldPtr)->map1d[(index)].origin)
+
+#define GET_CHILDREN(worldPtr, index) \
+		((worldPtr)->map1d[(index)].children)
+
+#define GET_FERTILITY_START(worldPtr, index) \
+		((worldPtr)->map1d[(index)].fertilityStart)
+
+#define GET_FERTILITY_END(worldPtr, index) \
+		((worldPtr)->map1d[(index)].fertilityEnd)
+
+static inline void readCell(WorldPtr world, CellIndex index, EntityPtr entity) {
+#ifdef COMPACT_ENTITY
+	unpackEntity(entity, world->map1d + index);
+#else
+	*entity = world->map1d[index];
+#endif
+}
+
+static inline void writeCell(WorldPtr world, CellIndex index, EntityPtr entity) {
+#ifdef COMPACT_ENTITY
+	packEntity(world->map1d + index, entity);
+#else
+	world->map1d[index] = *entity;
+#endif
+	updateCellBits(world, index, entity->type, entity->gender);
+}
+
+static inline void copyCell(WorldPtr dest, CellIndex destIndex, WorldPtr src,
+		CellIndex srcIndex) {
+	dest->map1d[destIndex] = src->map1d[srcIndex];
+	updateCellBits(dest, destIndex, GET_TYPE(dest, destIndex),
+			GET_GENDER(dest, destIndex));
+}
+
+static inline void clearCell(WorldPtr world, CellIndex index) {
+	world->map1d[index].type = NONE;
+	updateCellBits(world, index, NONE, MALE);
+}
+
+#endif // SOA_WORLD
+
+/**
+ * Returns base pointers and sizes of all the planes of the world.
+ */
+void getCellPlanes(WorldPtr world, void * bases[CELL_PLANES],
+		size_t sizes[CELL_PLANES]);
 
 /**
  * Creates a new world of specified dimensions as it is the only one.
  */
 WorldPtr newWorld(unsigned int width, unsigned int height);
 
+/**
+ * Touches all the pages of the world for the first time by the threads
+ * which process the tiles in them, so they are allocated in the memory
+ * close to those threads if the threads are bound to cores.
+ * Called by newWorld, outside of a parallel region.
+ */
+void touchWorld(WorldPtr world);
+
+/**
+ * Logs the size of the world, the pages in which it is stored
+ * and their placement on the NUMA nodes, as Linux reports them.
+ */
+void logWorldMemory(WorldPtr world);
+
 /**
  * Resets the world - removes all entities.
+ * Only the cells marked in the occupancy plane are written,
+ * so the time is proportional to the number of entities.
+ * Called by all the threads of the parallel region of the step
+ * (see simulateStep) or outside of one.
  */
 void resetWorld(WorldPtr world);
 
 /**
- * Destroys the entities in the world and than destroys the world.
+ * Divides the interior of the world into tiles.
+ * Must be called again when the interior changes.
  */
-void destroyWorld(WorldPtr world);
+void makeTiles(WorldPtr world);
 
 /**
- * Locks three adjacent columns centered around x for exclusive access.
+ * Recomputes the bit planes of the rectangle (bounds are inclusive)
+ * after the cells were written directly, e.g. by MPI.
+ * Called like resetWorld.
  */
-void lockColumn(WorldPtr world, int x);
+void refreshBits(WorldPtr world, int x1, int x2, int y1, int y2);
 
 /**
- * Unlocks the locked columns so everybody can use them.
+ * Destroys the entities in the world and than destroys the world.
  */
-void unlockColumn(WorldPtr world, int x);
+void destroyWorld(WorldPtr world);
 
 /**
- * Returns the first adjacent cell to [x,y] in output which is free in both worlds.
- * Returns NULL if none is free.
+ * Returns the first adjacent cell to index in output which is free in both worlds.
+ * Returns NO_CELL if none is free.
  */
-CellPtr getFreeAdjacent(WorldPtr input, WorldPtr output, int x, int y);
+CellIndex getFreeAdjacent(WorldPtr input, WorldPtr output, CellIndex index);
 
 #endif // WORLD_H_
 
@@ -0,0 +1,105 @@
+/*
+ * bearing.c
+ *
+ * Compares the table driven getBearing with the direct getBearingDirect.
+ * Usage: bearing [size] [repeats] [zombies density]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <complex.h>
+
+#include "world.h"
+#include "bearing.h"
+#include "random.h"
+#include "constants.h"
+#include "log.h"
+
+/**
+ * Fills the world with humans and zombies.
+ * Returns the array of occupied cells.
+ */
+static CellIndex * populate(WorldPtr world, double zombies, int * count) {
+	CellIndex * occupied = malloc(
+			sizeof(CellIndex) * world->localWidth * world->localHeight);
+	*count = 0;
+	for (int x = world->xStart; x <= world->xEnd; x++) {
+		for (int y = world->yStart; y <= world->yEnd; y++) {
+			double rnd = randomDouble();
+			Entity entity;
+			if (rnd < zombies) {
+				newZombie(&entity, 0);
+			} else if (rnd < zombies + INITIAL_DENSITY) {
+				newHuman(&entity, 0);
+			} else {
+				continue;
+			}
+			CellIndex index = CELL_INDEX(world, x, y);
+			writeCell(world, index, &entity);
+			occupied[(*count)++] = index;
+		}
+	}
+	return occupied;
+}
+
+int main(int argc, char **argv) {
+	int size = argc > 1 ? atoi(argv[1]) : 1024;
+	int repeats = argc > 2 ? atoi(argv[2]) : 20;
+	double zombies = argc > 3 ? atof(argv[3]) : 0.01;
+
+	initRandom(0);
+	initBearingTables();
+
+	WorldPtr world = newWorld(size, size);
+	int count;
+	CellIndex * occupied = populate(world, zombies, &count);
+
+	Entity * entities = malloc(sizeof(Entity) * count);
+	for (int i = 0; i < count; i++) {
+		readCell(world, occupied[i], entities + i);
+	}
+
+	double maxDifference = 0;
+	for (int i = 0; i < count; i++) {
+		bearing direct = getBearingDirect(world, occupied[i], entities + i);
+		bearing table = getBearing(world, occupied[i], entities + i);
+		double difference = cabs(direct - table);
+		if (difference > maxDifference) {
+			maxDifference = difference;
+		}
+	}
+
+	// the sums prevent the compiler from removing the calls
+	bearing directSum = NO_BEARING;
+	Timer timer = startTimer();
+	for (int r = 0; r < repeats; r++) {
+		for (int i = 0; i < count; i++) {
+			directSum += getBearingDirect(world, occupied[i], entities + i);
+		}
+	}
+	double directTime = getElapsedTime(timer);
+
+	bearing tableSum = NO_BEARING;
+	timer = startTimer();
+	for (int r = 0; r < repeats; r++) {
+		for (int i = 0; i < count; i++) {
+			tableSum += getBearing(world, occupied[i], entities + i);
+		}
+	}
+	double tableTime = getElapsedTime(timer);
+
+	double calls = (double) repeats * count;
+	printf("Entities: %d \tRepeats: %d \tMax difference: %g\n", count,
+			repeats, maxDifference);
+	LOG_TIME("getBearingDirect took %f milliseconds (%f ns per call)\n",
+			directTime, directTime * 1e6 / calls);
+	LOG_TIME("getBearing took %f milliseconds (%f ns per call)\n", tableTime,
+			tableTime * 1e6 / calls);
+	LOG_DEBUG("Checksums %f %f\n", cabsf(directSum), cabsf(tableSum));
+
+	free(entities);
+	free(occupied);
+	destroyWorld(world);
+	destroyRandom();
+	return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * directions.c
+ *
+ * Checks that bearingToDirection gives the same directions as the original
+ * bearingToDirectionDirect and compares their speed.
+ * The bearings are checked on a fine grid, along the diagonals
+ * and along the unit circle, including the neighbouring floats.
+ * Usage: directions [grid steps per unit] [samples] [repeats]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <complex.h>
+
+#include "direction.h"
+#include "random.h"
+#include "log.h"
+
+#define GRID_RANGE 4 // the grid covers [-GRID_RANGE, GRID_RANGE]^2
+#define NEIGHBOURS 4 // floats on each side of the borders which are checked
+
+static long long checked = 0;
+static long long mismatches = 0;
+
+static void check(float re, float im) {
+	bearing bearing_ = re + I * im;
+	Direction direct = bearingToDirectionDirect(bearing_);
+	Direction fast = bearingToDirection(bearing_);
+	checked++;
+	if (direct != fast) {
+		if (mismatches++ < 10) {
+			printf("Mismatch at %.9g%+.9gi: %d instead of %d\n", re, im, fast,
+					direct);
+		}
+	}
+}
+
+/**
+ * Checks the bearing and its neighbours in all four quadrants.
+ */
+static void checkAround(float re, float im) {
+	for (int i = -NEIGHBOURS; i <= NEIGHBOURS; i++) {
+		float x = re;
+		for (int k = 0; k < abs(i); k++) {
+			x = nextafterf(x, i < 0 ? 0 : INFINITY);
+		}
+		for (int j = -NEIGHBOURS; j <= NEIGHBOURS; j++) {
+			float y = im;
+			for (int k = 0; k < abs(j); k++) {
+				y = nextafterf(y, j < 0 ? 0 : INFINITY);
+			}
+			check(x, y);
+			check(-x, y);
+			check(x, -y);
+			check(-x, -y);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	int steps = argc > 1 ? atoi(argv[1]) : 512;
+	int samples = argc > 2 ? atoi(argv[2]) : 1 << 20;
+	int repeats = argc > 3 ? atoi(argv[3]) : 20;
+
+	// the grid, which includes the axes and the diagonals
+	for (int i = -GRID_RANGE * steps; i <= GRID_RANGE * steps; i++) {
+		for (int j = -GRID_RANGE * steps; j <= GRID_RANGE * steps; j++) {
+			check((float) i / steps, (float) j / steps);
+		}
+	}
+	long long gridChecked = checked;
+
+	// the diagonals and the unit circle
+	for (int i = 1; i <= GRID_RANGE * steps; i++) {
+		float x = (float) i / steps;
+		checkAround(x, x);
+		checkAround(x * (float) M_SQRT1_2, x * (float) M_SQRT1_2);
+		if (x <= 1) {
+			checkAround(x, sqrtf(1 - x * x));
+		}
+	}
+	checkAround(1, 0);
+	checkAround(0, 1);
+	checkAround(0, 0);
+
+	printf("Checked %lld bearings (%lld on the grid): %lld mismatches\n",
+			checked, gridChecked, mismatches);
+
+	// the speed on bearings as they are in the simulation
+	initRandom(0);
+	setRandomStream(0, 0, 0, RANDOM_STREAM_MAIN);
+	bearing * bearings = malloc(sizeof(bearing) * samples);
+	for (int i = 0; i < samples; i++) {
+		bearings[i] = getRandomBearing() * (float) (4 * randomDouble());
+	}
+
+	// the sums prevent the compiler from removing the calls
+	int directSum = 0;
+	Timer timer = startTimer();
+	for (int r = 0; r < repeats; r++) {
+		for (int i = 0; i < samples; i++) {
+			directSum += bearingToDirectionDirect(bearings[i]);
+		}
+	}
+	double directTime = getElapsedTime(timer);
+
+	int fastSum = 0;
+	timer = startTimer();
+	for (int r = 0; r < repeats; r++) {
+		for (int i = 0; i < samples; i++) {
+			fastSum += bearingToDirection(bearings[i]);
+		}
+	}
+	double fastTime = getElapsedTime(timer);
+
+	double calls = (double) repeats * samples;
+	LOG_TIME("bearingToDirectionDirect took %f milliseconds (%f ns per call)\n",
+			directTime, directTime * 1e6 / calls);
+	LOG_TIME("bearingToDirection took %f milliseconds (%f ns per call)\n",
+			fastTime, fastTime * 1e6 / calls);
+	LOG_DEBUG("Checksums %d %d\n", directSum, fastSum);
+
+	free(bearings);
+	destroyRandom();
+	return mismatches != 0;
+}
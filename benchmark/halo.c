@@ -0,0 +1,267 @@
+/*
+ * halo.c
+ *
+ * Checks that the packed halo exchange fills the border
+ * the same way as the original exchange, which sent each line and plane
+ * as a separate message described by a derived type, and compares
+ * their speed and the bytes sent. Each round trip is one exchange
+ * with all the neighbours. The density decides whether the messages
+ * are sparse or dense. Built with SHARED_HALOS, the processes on the same
+ * node copy the lines of each other instead, so nothing is sent among them.
+ * Usage: mpirun -np N halo [width] [height] [repeats] [density]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "world.h"
+#include "communication.h"
+#include "halo.h"
+#include "random.h"
+#include "entity.h"
+#include "constants.h"
+#include "log.h"
+
+#ifndef USE_MPI
+#error "The halo benchmark must be compiled with USE_MPI"
+#endif
+
+// the original tags, one per line
+#define TOP_TAG 0
+#define TOP1_TAG 1
+#define BOTTOM_TAG 2
+#define BOTTOM1_TAG 3
+#define LEFT_TAG 4
+#define LEFT1_TAG 5
+#define RIGHT_TAG 6
+#define RIGHT1_TAG 7
+
+#define DIRECT_REQUESTS (4 * 4 * CELL_PLANES)
+
+static MPI_Datatype rowType[CELL_PLANES];
+static MPI_Datatype columnType[CELL_PLANES];
+static MPI_Request requests[DIRECT_REQUESTS];
+static int requestCount = 0;
+
+static void initTypes(WorldPtr world) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+	for (int p = 0; p < CELL_PLANES; p++) {
+		MPI_Datatype cellType;
+		MPI_Type_contiguous(sizes[p], MPI_BYTE, &cellType);
+		MPI_Type_commit(&cellType);
+
+		MPI_Type_vector(world->localWidth, 1, world->stride, cellType,
+				rowType + p);
+		MPI_Type_commit(rowType + p);
+
+		MPI_Type_vector(1, world->localHeight, -1, cellType, columnType + p);
+		MPI_Type_commit(columnType + p);
+	}
+}
+
+static void sendCells(WorldPtr world, int x, int y, MPI_Datatype * types,
+		int dest, int tag) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+	CellIndex index = CELL_INDEX(world, x, y);
+	for (int p = 0; p < CELL_PLANES; p++) {
+		MPI_Isend((char *) bases[p] + index * sizes[p], 1, types[p], dest,
+				tag * CELL_PLANES + p, world->comm,
+				requests + (requestCount++));
+	}
+}
+
+static void receiveCells(WorldPtr world, int x, int y, MPI_Datatype * types,
+		int source, int tag) {
+	void * bases[CELL_PLANES];
+	size_t sizes[CELL_PLANES];
+	getCellPlanes(world, bases, sizes);
+	CellIndex index = CELL_INDEX(world, x, y);
+	for (int p = 0; p < CELL_PLANES; p++) {
+		MPI_Irecv((char *) bases[p] + index * sizes[p], 1, types[p], source,
+				tag * CELL_PLANES + p, world->comm,
+				requests + (requestCount++));
+	}
+}
+
+/**
+ * The original border exchange, including looking up the neighbours.
+ */
+static void exchangeBorderDirect(WorldPtr w) {
+	int rank, up, down, left, right;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Cart_shift(w->comm, SHIFT_UP_DOWN, -1, &rank, &up);
+	MPI_Cart_shift(w->comm, SHIFT_UP_DOWN, +1, &rank, &down);
+	MPI_Cart_shift(w->comm, SHIFT_LEFT_RIGHT, -1, &rank, &left);
+	MPI_Cart_shift(w->comm, SHIFT_LEFT_RIGHT, +1, &rank, &right);
+
+	sendCells(w, w->xStart, w->yStart, rowType, up, TOP_TAG);
+	sendCells(w, w->xStart, w->yStart + 1, rowType, up, TOP1_TAG);
+	receiveCells(w, w->xStart, w->yEnd + 1, rowType, down, TOP_TAG);
+	receiveCells(w, w->xStart, w->yEnd + 2, rowType, down, TOP1_TAG);
+
+	sendCells(w, w->xStart, w->yEnd, rowType, down, BOTTOM_TAG);
+	sendCells(w, w->xStart, w->yEnd - 1, rowType, down, BOTTOM1_TAG);
+	receiveCells(w, w->xStart, w->yStart - 1, rowType, up, BOTTOM_TAG);
+	receiveCells(w, w->xStart, w->yStart - 2, rowType, up, BOTTOM1_TAG);
+
+	sendCells(w, w->xStart, w->yStart, columnType, left, LEFT_TAG);
+	sendCells(w, w->xStart + 1, w->yStart, columnType, left, LEFT1_TAG);
+	receiveCells(w, w->xEnd + 1, w->yStart, columnType, right, LEFT_TAG);
+	receiveCells(w, w->xEnd + 2, w->yStart, columnType, right, LEFT1_TAG);
+
+	sendCells(w, w->xEnd, w->yStart, columnType, right, RIGHT_TAG);
+	sendCells(w, w->xEnd - 1, w->yStart, columnType, right, RIGHT1_TAG);
+	receiveCells(w, w->xStart - 1, w->yStart, columnType, left, RIGHT_TAG);
+	receiveCells(w, w->xStart - 2, w->yStart, columnType, left, RIGHT1_TAG);
+
+	MPI_Waitall(requestCount, requests, MPI_STATUSES_IGNORE);
+	requestCount = 0;
+}
+
+/**
+ * The halos are exchanged by the threads of a parallel region,
+ * as in the step.
+ */
+static void exchangeBorder(WorldPtr world) {
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		startHalo(world, &world->border);
+		finishHalo(world, &world->border);
+	}
+}
+
+static void exchangeGhosts(WorldPtr world) {
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		startHalo(world, &world->ghosts);
+		finishHalo(world, &world->ghosts);
+	}
+}
+
+/**
+ * Reads the cells of the outer border which are exchanged
+ * or clears them when entities is NULL. Returns the count of cells.
+ */
+static int readBorder(WorldPtr world, Entity * entities) {
+	int count = 0;
+	for (int x = world->xStart - 2; x <= world->xEnd + 2; x++) {
+		for (int y = world->yStart - 2; y <= world->yEnd + 2; y++) {
+			bool rowBorder = y < world->yStart || y > world->yEnd;
+			bool columnBorder = x < world->xStart || x > world->xEnd;
+			if (rowBorder == columnBorder) {
+				continue; // interior or corner, which is not exchanged
+			}
+			CellIndex index = CELL_INDEX(world, x, y);
+			if (entities == NULL) {
+				clearCell(world, index);
+			} else {
+				memset(entities + count, 0, sizeof(Entity));
+				if (GET_TYPE(world, index) != NONE) {
+					readCell(world, index, entities + count);
+				}
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * Runs the exchange repeatedly and returns the slowest time
+ * of all the processes in milliseconds.
+ */
+static double timeExchange(void (*exchange)(WorldPtr), WorldPtr world,
+		int repeats) {
+	MPI_Barrier(world->comm);
+	Timer timer = startTimer();
+	for (int r = 0; r < repeats; r++) {
+		exchange(world);
+	}
+	double elapsedTime = getElapsedTime(timer);
+	double maxTime;
+	MPI_Allreduce(&elapsedTime, &maxTime, 1, MPI_DOUBLE, MPI_MAX, world->comm);
+	return maxTime;
+}
+
+int main(int argc, char **argv) {
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	int width = argc > 1 ? atoi(argv[1]) : 4096;
+	int height = argc > 2 ? atoi(argv[2]) : 4096;
+	int repeats = argc > 3 ? atoi(argv[3]) : 200;
+	double density = argc > 4 ? atof(argv[4]) : INITIAL_DENSITY;
+
+	initRandom(0);
+	WorldPtr input, output;
+	divideWorld(&width, &height, &input, &output);
+	initTypes(input);
+
+	// the people are placed as in the simulation, at the given density
+	setRandomStream(0, input->globalX, input->globalY, RANDOM_STREAM_MAIN);
+	for (int x = input->xStart; x <= input->xEnd; x++) {
+		for (int y = input->yStart; y <= input->yEnd; y++) {
+			if (randomDouble() < density) {
+				Entity human;
+				newHuman(&human, 0);
+				writeCell(input, CELL_INDEX(input, x, y), &human);
+			}
+		}
+	}
+
+	int cells = readBorder(input, NULL);
+	Entity * direct = malloc(sizeof(Entity) * cells);
+	Entity * packed = malloc(sizeof(Entity) * cells);
+	exchangeBorderDirect(input);
+	readBorder(input, direct);
+	readBorder(input, NULL);
+	exchangeBorder(input);
+	readBorder(input, packed);
+	int mismatch = memcmp(direct, packed, sizeof(Entity) * cells) != 0;
+	int mismatches;
+	MPI_Allreduce(&mismatch, &mismatches, 1, MPI_INT, MPI_SUM, input->comm);
+	free(direct);
+	free(packed);
+
+	// the bytes of all the messages which would be sent densely
+	long long denseBytes = 0;
+	for (int side = 0; side < input->border.sideCount; side++) {
+		HaloSide * s = input->border.sides + side;
+		denseBytes += s->bytes;
+	}
+	input->border.sentBytes = 0;
+	double directTime = timeExchange(exchangeBorderDirect, input, repeats);
+	double borderTime = timeExchange(exchangeBorder, input, repeats);
+	double ghostsTime = timeExchange(exchangeGhosts, output, repeats);
+
+	if (input->globalX == 0 && input->globalY == 0) {
+		printf("%d processes in %d x %d, part of %d x %d: "
+				"%d processes with a different border\n",
+				input->globalColumns * input->globalRows,
+				input->globalColumns, input->globalRows, input->localWidth,
+				input->localHeight, mismatches);
+		LOG_TIME("original border took %f milliseconds (%f us per exchange)\n",
+				directTime, directTime * 1e3 / repeats);
+		LOG_TIME("packed border took %f milliseconds (%f us per exchange)\n",
+				borderTime, borderTime * 1e3 / repeats);
+		LOG_TIME("packed ghosts took %f milliseconds (%f us per exchange)\n",
+				ghostsTime, ghostsTime * 1e3 / repeats);
+		printf("The first process sent %.0f bytes of the border "
+				"per exchange instead of %lld\n",
+				(double) input->border.sentBytes / repeats, denseBytes);
+	}
+
+	destroyWorld(input);
+	destroyWorld(output);
+	destroyRandom();
+	MPI_Finalize();
+	return mismatches != 0;
+}
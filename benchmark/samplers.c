@@ -0,0 +1,279 @@
+/*
+ * samplers.c
+ *
+ * Compares randomNormal and getRandomBearing with the original
+ * randomNormalDirect and getRandomBearingDirect and with their bulk
+ * variants, and measures the cost of chooseDirection per moving entity.
+ * The bulk variants are checked against the scalar ones by two-sample
+ * chi-square tests, the exit status is 1 if any of them fails.
+ * Usage: samplers [samples] [entities] [repeats]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <complex.h>
+
+#include "simulation.h"
+#include "direction.h"
+#include "random.h"
+#include "entity.h"
+#include "log.h"
+
+#define ANGLE_BINS 64
+#define NORMAL_BINS 64
+#define NORMAL_RANGE 4.0 // the outer bins take the tails
+#define CHI_SQUARE_Z 3.09 // the quantile of the tests is 0.999
+
+/**
+ * First four moments of a sample.
+ */
+typedef struct Moments {
+	double mean;
+	double variance;
+	double skewness;
+	double kurtosis; // excess
+} Moments;
+
+static Moments getMoments(const double * values, int count) {
+	double sum = 0;
+	for (int i = 0; i < count; i++) {
+		sum += values[i];
+	}
+	Moments moments = { sum / count, 0, 0, 0 };
+	double m2 = 0, m3 = 0, m4 = 0;
+	for (int i = 0; i < count; i++) {
+		double d = values[i] - moments.mean;
+		m2 += d * d;
+		m3 += d * d * d;
+		m4 += d * d * d * d;
+	}
+	m2 /= count;
+	m3 /= count;
+	m4 /= count;
+	moments.variance = m2;
+	moments.skewness = m3 / pow(m2, 1.5);
+	moments.kurtosis = m4 / (m2 * m2) - 3;
+	return moments;
+}
+
+/**
+ * Counts the angles of the bearings in ANGLE_BINS bins
+ * and returns the largest deviation of the absolute value from 0.5.
+ */
+static double histogramAngles(const bearing * bearings, int count,
+		int * bins) {
+	double maxAbsError = 0;
+	for (int b = 0; b < ANGLE_BINS; b++) {
+		bins[b] = 0;
+	}
+	for (int i = 0; i < count; i++) {
+		double angle = cargf(bearings[i]) + M_PI; // in [0, 2 PI]
+		int bin = angle * (ANGLE_BINS / (2 * M_PI));
+		bins[bin < ANGLE_BINS ? bin : ANGLE_BINS - 1]++;
+		double error = fabs(cabsf(bearings[i]) - 0.5);
+		if (error > maxAbsError) {
+			maxAbsError = error;
+		}
+	}
+	return maxAbsError;
+}
+
+/**
+ * Counts the values in NORMAL_BINS bins of [-NORMAL_RANGE, NORMAL_RANGE].
+ */
+static void histogramNormals(const double * values, int count, int * bins) {
+	for (int b = 0; b < NORMAL_BINS; b++) {
+		bins[b] = 0;
+	}
+	for (int i = 0; i < count; i++) {
+		double position = (values[i] + NORMAL_RANGE)
+				* (NORMAL_BINS / (2 * NORMAL_RANGE));
+		int bin = position < 0 ? 0 : (int) position;
+		bins[bin < NORMAL_BINS ? bin : NORMAL_BINS - 1]++;
+	}
+}
+
+/**
+ * Returns the chi-square statistic of two histograms of samples
+ * of the same size against the hypothesis that they come from the same
+ * distribution. The degrees of freedom are the non-empty bins minus one.
+ */
+static double getTwoSampleChiSquare(const int * a, const int * b, int count,
+		int * freedom) {
+	double chiSquare = 0;
+	*freedom = -1;
+	for (int i = 0; i < count; i++) {
+		if (a[i] + b[i] > 0) {
+			double d = a[i] - b[i];
+			chiSquare += d * d / (a[i] + b[i]);
+			(*freedom)++;
+		}
+	}
+	return chiSquare;
+}
+
+/**
+ * Returns the CHI_SQUARE_Z quantile of the chi-square distribution
+ * by the Wilson-Hilferty approximation.
+ */
+static double getChiSquareLimit(int freedom) {
+	double s = 2.0 / (9.0 * freedom);
+	double c = 1 - s + CHI_SQUARE_Z * sqrt(s);
+	return freedom * c * c * c;
+}
+
+/**
+ * Prints the result of a two-sample test and returns whether it passed.
+ */
+static bool checkSameDistribution(const char * name, const int * a,
+		const int * b, int count) {
+	int freedom;
+	double chiSquare = getTwoSampleChiSquare(a, b, count, &freedom);
+	double limit = getChiSquareLimit(freedom);
+	bool passed = chiSquare <= limit;
+	printf("%-20s two-sample chi-square %.1f (limit %.1f, %d dof) 	%s\n",
+			name, chiSquare, limit, freedom, passed ? "passed" : "FAILED");
+	return passed;
+}
+
+/**
+ * Returns the chi-square statistic of the angles against the uniform
+ * distribution (ANGLE_BINS - 1 degrees of freedom)
+ * and the largest deviation of the absolute value from 0.5.
+ */
+static double getAngleChiSquare(const bearing * bearings, int count,
+		double * maxAbsError) {
+	int bins[ANGLE_BINS];
+	*maxAbsError = histogramAngles(bearings, count, bins);
+	double expected = (double) count / ANGLE_BINS;
+	double chiSquare = 0;
+	for (int b = 0; b < ANGLE_BINS; b++) {
+		chiSquare += (bins[b] - expected) * (bins[b] - expected) / expected;
+	}
+	return chiSquare;
+}
+
+static void printMoments(const char * name, Moments moments) {
+	printf("%-20s mean %+.5f \tvariance %.5f \tskewness %+.5f "
+			"\tkurtosis %+.5f\n", name, moments.mean, moments.variance,
+			moments.skewness, moments.kurtosis);
+}
+
+int main(int argc, char **argv) {
+	int samples = argc > 1 ? atoi(argv[1]) : 1 << 22;
+	int entities = argc > 2 ? atoi(argv[2]) : 1 << 16;
+	int repeats = argc > 3 ? atoi(argv[3]) : 50;
+
+	initRandom(0);
+	setRandomStream(0, 0, 0, RANDOM_STREAM_MAIN);
+
+	// accuracy and speed of the normal samplers
+	double * normals = malloc(sizeof(double) * samples);
+	Timer timer = startTimer();
+	for (int i = 0; i < samples; i++) {
+		normals[i] = randomNormalDirect();
+	}
+	double directNormalTime = getElapsedTime(timer);
+	printMoments("randomNormalDirect", getMoments(normals, samples));
+
+	timer = startTimer();
+	for (int i = 0; i < samples; i++) {
+		normals[i] = randomNormal();
+	}
+	double normalTime = getElapsedTime(timer);
+	printMoments("randomNormal", getMoments(normals, samples));
+	int scalarNormalBins[NORMAL_BINS];
+	histogramNormals(normals, samples, scalarNormalBins);
+
+	timer = startTimer();
+	randomNormals(normals, samples);
+	double normalsTime = getElapsedTime(timer);
+	printMoments("randomNormals", getMoments(normals, samples));
+	int normalBins[NORMAL_BINS];
+	histogramNormals(normals, samples, normalBins);
+	free(normals);
+
+	// accuracy and speed of the bearing samplers
+	bearing * bearings = malloc(sizeof(bearing) * samples);
+	timer = startTimer();
+	for (int i = 0; i < samples; i++) {
+		bearings[i] = getRandomBearingDirect();
+	}
+	double directBearingTime = getElapsedTime(timer);
+	double directAbsError;
+	double directChiSquare = getAngleChiSquare(bearings, samples,
+			&directAbsError);
+
+	timer = startTimer();
+	for (int i = 0; i < samples; i++) {
+		bearings[i] = getRandomBearing();
+	}
+	double bearingTime = getElapsedTime(timer);
+	int scalarAngleBins[ANGLE_BINS];
+	double scalarAbsError = histogramAngles(bearings, samples,
+			scalarAngleBins);
+
+	timer = startTimer();
+	getRandomBearings(bearings, samples);
+	double bearingsTime = getElapsedTime(timer);
+	double absError;
+	double chiSquare = getAngleChiSquare(bearings, samples, &absError);
+	int angleBins[ANGLE_BINS];
+	histogramAngles(bearings, samples, angleBins);
+	printf("%-20s chi-square %.1f (%d bins) \tmax abs error %g\n",
+			"getRandomBearingDir.", directChiSquare, ANGLE_BINS,
+			directAbsError);
+	printf("%-20s max abs error %g\n", "getRandomBearing", scalarAbsError);
+	printf("%-20s chi-square %.1f (%d bins) \tmax abs error %g\n",
+			"getRandomBearings", chiSquare, ANGLE_BINS, absError);
+
+	// the bulk samplers must draw from the same distributions
+	// as the scalar ones
+	bool passed = checkSameDistribution("randomNormals", scalarNormalBins,
+			normalBins, NORMAL_BINS);
+	passed &= checkSameDistribution("getRandomBearings", scalarAngleBins,
+			angleBins, ANGLE_BINS);
+
+	// movement of entities which are not attracted by anything
+	Entity * population = malloc(sizeof(Entity) * entities);
+	bearing * targets = malloc(sizeof(bearing) * entities);
+	for (int i = 0; i < entities; i++) {
+		newHuman(population + i, 0);
+		targets[i] = NO_BEARING;
+	}
+	int moves = 0;
+	timer = startTimer();
+	for (int r = 0; r < repeats; r++) {
+		for (int i = 0; i < entities; i++) {
+			moves += chooseDirection(population + i,
+					population[i].bearing + targets[i], 0) != STAY;
+		}
+	}
+	double movementTime = getElapsedTime(timer);
+	free(targets);
+	free(population);
+	bearing checksum = bearings[0] + bearings[samples - 1];
+	free(bearings);
+
+	double calls = samples;
+	LOG_TIME("randomNormalDirect took %f milliseconds (%f ns per call)\n",
+			directNormalTime, directNormalTime * 1e6 / calls);
+	LOG_TIME("randomNormal took %f milliseconds (%f ns per call)\n",
+			normalTime, normalTime * 1e6 / calls);
+	LOG_TIME("randomNormals took %f milliseconds (%f ns per variate)\n",
+			normalsTime, normalsTime * 1e6 / calls);
+	LOG_TIME("getRandomBearingDirect took %f milliseconds (%f ns per call)\n",
+			directBearingTime, directBearingTime * 1e6 / calls);
+	LOG_TIME("getRandomBearing took %f milliseconds (%f ns per call)\n",
+			bearingTime, bearingTime * 1e6 / calls);
+	LOG_TIME("getRandomBearings took %f milliseconds (%f ns per bearing)\n",
+			bearingsTime, bearingsTime * 1e6 / calls);
+	calls = (double) repeats * entities;
+	LOG_TIME("chooseDirection took %f milliseconds (%f ns per entity)\n",
+			movementTime, movementTime * 1e6 / calls);
+	LOG_DEBUG("Checksums %d %f\n", moves, cabsf(checksum));
+
+	destroyRandom();
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#!/usr/bin/python
+
+# to be run in the directory where tile_tasks.py was run
+# prints: tile size threads milliseconds
+
+import glob
+import math
+import re
+
+pattern = re.compile(r'TIME: Simulation took ([0-9.]+) milliseconds')
+
+for path in sorted(glob.glob('tile-*/s-*/t-*/slurm-*.out')):
+    (tile, size, threads) = path.split('/')[:3]
+    for line in open(path):
+        match = pattern.search(line)
+        if match:
+            print("{tile}\t{size}\t{threads}\t{time}"
+                  .format(tile=tile[5:], size=size[2:], threads=threads[2:],
+                          time=math.ceil(float(match.group(1)))))
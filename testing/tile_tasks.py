@@ -0,0 +1,61 @@
+#!/usr/bin/python2
+
+# to be run in root directory of the project
+# compares the sizes and orders of tiles (see TILE_WIDTH and TILE_HEIGHT)
+# every configuration gets its own binary
+
+import os, sys
+import subprocess
+
+# (width, height, morton); the last one is one tile per column
+tiles = [(16, 128, 0), (32, 128, 0), (32, 512, 0), (64, 512, 0),
+         (32, 512, 1), (16384, 16384, 0)]
+sizes = [4096, 16384]
+threads = [1, 32]
+steps = 100
+
+sbatch = """#!/bin/bash
+#SBATCH --job-name="ZombieApocalypse-juriad-{size}_size-{threads}_threads-{tile}_tile"
+#SBATCH --nodes=1
+#SBATCH --time=0-6:0
+export OMP_NUM_THREADS={threads}
+srun --ntasks-per-node=1 ../../apocalypse {size} {size} 2 {steps}
+"""
+
+root = os.getcwd()
+for (w, h, morton) in tiles:
+    tile = str(w) + 'x' + str(h) + ('-morton' if morton else '')
+    dir = 'tile-' + tile
+    os.mkdir(dir)
+    os.chdir(dir)
+
+    args = ['make', '-C', os.path.join(root, 'apocalypse'), '-B',
+            'NIMAGES=1', 'NPOPULATION=1',
+            'TILE_WIDTH=' + str(w), 'TILE_HEIGHT=' + str(h)]
+    if morton:
+        args.append('TILE_ORDER_MORTON=1')
+    subprocess.call(args)
+    subprocess.call(['cp', os.path.join(root, 'apocalypse', 'apocalypse'), '.'])
+
+    for s in sizes:
+        dir2 = 's-' + str(s)
+        os.mkdir(dir2)
+        os.chdir(dir2)
+        for t in threads:
+            dir3 = 't-' + str(t)
+            os.mkdir(dir3)
+            os.chdir(dir3)
+
+            os.mkdir('images')
+            os.mkdir('output')
+
+            f = open('apocalypse.sbatch','w')
+            filled = sbatch.format(size=s, threads=t, steps=steps, tile=tile)
+            f.write(filled)
+            f.close()
+
+            subprocess.call(['sbatch', './apocalypse.sbatch'])
+
+            os.chdir('..')
+        os.chdir('..')
+    os.chdir('..')
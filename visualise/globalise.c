@@ -136,16 +136,16 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 
 	do {
 		long long int time;
-		int humans = 0;
-		int infected = 0;
-		int zombies = 0;
+		long long humans = 0;
+		long long infected = 0;
+		long long zombies = 0;
 
 		Stats stats = NO_STATS;
 		for (int x = 0; x < width; x++) {
 			for (int y = 0; y < height; y++) {
 				char line[1024];
 
-				int h, i, z;
+				long long h, i, z;
 				char * whatsGoingOn;
 				whatsGoingOn = fgets(line, sizeof(line), matrix[x][y]);
 				if (whatsGoingOn == NULL) {
@@ -153,7 +153,7 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 				}
 
 				sscanf(line,
-						"Time: %6lld \tHumans: %6d \tInfected: %6d \tZombies: %6d\n",
+						"Time: %6lld \tHumans: %6lld \tInfected: %6lld \tZombies: %6lld\n",
 						&time, &h, &i, &z);
 				humans += h;
 				infected += i;
@@ -169,9 +169,9 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 
 				if (detailed) {
 					fgets(line, sizeof(line), matrix[x][y]);
-					int lhf, lhm, lif, lim, lz;
+					long long lhf, lhm, lif, lim, lz;
 					sscanf(line,
-							"LHF: %6d \tLHM: %6d \tLIF: %6d \tLIM: %6d \tLZ:  %6d\n",
+							"LHF: %6lld \tLHM: %6lld \tLIF: %6lld \tLIM: %6lld \tLZ:  %6lld\n",
 							&lhf, &lhm, &lif, &lim, &lz);
 					stats.humanFemales += lhf;
 					stats.humanMales += lhm;
@@ -180,9 +180,9 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 					stats.zombies += lz;
 
 					fgets(line, sizeof(line), matrix[x][y]);
-					int dhf, dhm, dif, dim, dz;
+					long long dhf, dhm, dif, dim, dz;
 					sscanf(line,
-							"DHF: %6d \tDHM: %6d \tDIF: %6d \tDIM: %6d \tDZ:  %6d\n",
+							"DHF: %6lld \tDHM: %6lld \tDIF: %6lld \tDIM: %6lld \tDZ:  %6lld\n",
 							&dhf, &dhm, &dif, &dim, &dz);
 					stats.humanFemalesDied += dhf;
 					stats.humanMalesDied += dhm;
@@ -191,8 +191,8 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 					stats.zombiesDecomposed += dz;
 
 					fgets(line, sizeof(line), matrix[x][y]);
-					int bhf, bhm, bif, bim;
-					sscanf(line, "BHF: %6d \tBHM: %6d \tBIF: %6d \tBIM: %6d\n",
+					long long bhf, bhm, bif, bim;
+					sscanf(line, "BHF: %6lld \tBHM: %6lld \tBIF: %6lld \tBIM: %6lld\n",
 							&bhf, &bhm, &bif, &bim);
 					stats.humanFemalesBorn += bhf;
 					stats.humanMalesBorn += bhm;
@@ -200,9 +200,9 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 					stats.infectedMalesBorn += bim;
 
 					fgets(line, sizeof(line), matrix[x][y]);
-					int ph, pi, gbh, gbi, cml, cc;
+					long long ph, pi, gbh, gbi, cml, cc;
 					sscanf(line,
-							"PH:  %6d \tPI:  %6d \tGBH: %6d \tGBI: %6d \tCML: %6d \tCC:  %6d\n",
+							"PH:  %6lld \tPI:  %6lld \tGBH: %6lld \tGBI: %6lld \tCML: %6lld \tCC:  %6lld\n",
 							&ph, &pi, &gbh, &gbi, &cml, &cc);
 					stats.humanFemalesPregnant += ph;
 					stats.infectedFemalesPregnant += pi;
@@ -212,8 +212,8 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 					stats.childrenConceived += cc;
 
 					fgets(line, sizeof(line), matrix[x][y]);
-					int ihf, ihm, ifz, imz;
-					sscanf(line, "IHF: %6d \tIHM: %6d \tIFZ: %6d \tIMZ: %6d\n",
+					long long ihf, ihm, ifz, imz;
+					sscanf(line, "IHF: %6lld \tIHM: %6lld \tIFZ: %6lld \tIMZ: %6lld\n",
 							&ihf, &ihm, &ifz, &imz);
 					stats.humanFemalesBecameInfected += ihf;
 					stats.humanMalesBecameInfected += ihm;
@@ -225,29 +225,29 @@ void globaliseStats(FILE * out, FILE *** matrix, int width, int height) {
 
 		// the same format as in ../apocalypse/output.c
 		fprintf(out,
-				"Time: %6lld \tHumans: %6d \tInfected: %6d \tZombies: %6d\n",
+				"Time: %6lld \tHumans: %6lld \tInfected: %6lld \tZombies: %6lld\n",
 				time, humans, infected, zombies);
 
 		if (detailed) {
 			fprintf(out,
-					"LHF: %6d \tLHM: %6d \tLIF: %6d \tLIM: %6d \tLZ:  %6d\n",
+					"LHF: %6lld \tLHM: %6lld \tLIF: %6lld \tLIM: %6lld \tLZ:  %6lld\n",
 					stats.humanFemales, stats.humanMales, stats.infectedFemales,
 					stats.infectedMales, stats.zombies);
 			fprintf(out,
-					"DHF: %6d \tDHM: %6d \tDIF: %6d \tDIM: %6d \tDZ:  %6d\n",
+					"DHF: %6lld \tDHM: %6lld \tDIF: %6lld \tDIM: %6lld \tDZ:  %6lld\n",
 					stats.humanFemalesDied, stats.humanMalesDied,
 					stats.infectedFemalesDied, stats.infectedMalesDied,
 					stats.zombiesDecomposed);
-			fprintf(out, "BHF: %6d \tBHM: %6d \tBIF: %6d \tBIM: %6d\n",
+			fprintf(out, "BHF: %6lld \tBHM: %6lld \tBIF: %6lld \tBIM: %6lld\n",
 					stats.humanFemalesBorn, stats.humanMalesBorn,
 					stats.infectedFemalesBorn, stats.infectedMalesBorn);
 			fprintf(out,
-					"PH:  %6d \tPI:  %6d \tGBH: %6d \tGBI: %6d \tCML: %6d \tCC:  %6d\n",
+					"PH:  %6lld \tPI:  %6lld \tGBH: %6lld \tGBI: %6lld \tCML: %6lld \tCC:  %6lld\n",
 					stats.humanFemalesPregnant, stats.infectedFemalesPregnant,
 					stats.humanFemalesBecameInfected,
 					stats.infectedFemalesGivingBirth, stats.couplesMakingLove,
 					stats.childrenConceived);
-			fprintf(out, "IHF: %6d \tIHM: %6d \tIFZ: %6d \tIMZ: %6d\n",
+			fprintf(out, "IHF: %6lld \tIHM: %6lld \tIFZ: %6lld \tIMZ: %6lld\n",
 					stats.humanFemalesBecameInfected,
 					stats.humanMalesBecameInfected,
 					stats.infectedFemalesBecameZombies,